@@ -0,0 +1,11 @@
+#ifndef ALLOC_COUNTER_HPP
+#define ALLOC_COUNTER_HPP
+
+#include <cstddef>
+
+// the benchmark binary replaces the global operator new, these toggle counting and
+// return the number of allocations made in between (from any thread)
+void startCountingAllocations();
+size_t stopCountingAllocations();
+
+#endif // ALLOC_COUNTER_HPP
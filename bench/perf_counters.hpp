@@ -0,0 +1,174 @@
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+// Hardware counters read through perf_event_open (Linux only). When the kernel refuses
+// (containers, perf_event_paranoid, other platforms) the counters report themselves as
+// unavailable and the benchmarks print n/a.
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+class PerfCounter {
+public:
+    // open false gives a counter that is never available
+    PerfCounter(uint32_t type, uint64_t config, bool open = true) {
+#ifdef __linux__
+        if (!open) return;
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1; // count the worker threads too
+        fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+    ~PerfCounter() {
+#ifdef __linux__
+        if (fd >= 0) close(fd);
+#endif
+    }
+    PerfCounter(const PerfCounter&) = delete;
+    PerfCounter& operator=(const PerfCounter&) = delete;
+
+    bool available() const { return fd >= 0; }
+
+    void start() {
+#ifdef __linux__
+        if (fd < 0) return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+
+    uint64_t stop() {
+        uint64_t value = 0;
+#ifdef __linux__
+        if (fd < 0) return 0;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &value, sizeof(value)) != sizeof(value)) value = 0;
+#endif
+        return value;
+    }
+
+private:
+    int fd = -1;
+};
+
+#ifdef __linux__
+constexpr uint64_t cacheEvent(uint64_t cache, uint64_t op, uint64_t result) {
+    return cache | (op << 8) | (result << 16);
+}
+#endif
+
+// the generic perf events have no L2 entry, so the L2 requests and misses are raw events of
+// the cpu: L2_RQSTS.REFERENCES/MISS (event 0x24) on Intel Skylake and later cores,
+// L2CacheReqStat all/ic_dc_miss_in_l2 (event 0x64) on AMD Zen. known is false elsewhere
+struct L2Events {
+    bool known = false;
+    uint64_t access = 0, miss = 0;
+};
+
+inline L2Events l2Events() {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx)) return {};
+    char vendor[13];
+    std::memcpy(vendor, &ebx, 4);
+    std::memcpy(vendor + 4, &edx, 4);
+    std::memcpy(vendor + 8, &ecx, 4);
+    vendor[12] = 0;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return {};
+    unsigned int family = (eax >> 8) & 0xf;
+    if (family == 0xf) family += (eax >> 20) & 0xff;
+    // umask << 8 | event
+    if (std::strcmp(vendor, "GenuineIntel") == 0 && family == 6) return {true, 0xff24, 0x3f24};
+    if (std::strcmp(vendor, "AuthenticAMD") == 0 && family >= 0x17) return {true, 0xff64, 0x0964};
+#endif
+    return {};
+}
+
+// L1d, L2 and last level cache read accesses/misses. the L2 counters are only there on the
+// cpus l2Events() knows, on most desktop parts the LLC is the L3
+struct CacheCounters {
+#ifdef __linux__
+    L2Events l2 = l2Events();
+    PerfCounter l1dAccess{PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_ACCESS)};
+    PerfCounter l1dMiss{PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)};
+    PerfCounter l2Access{PERF_TYPE_RAW, l2.access, l2.known};
+    PerfCounter l2Miss{PERF_TYPE_RAW, l2.miss, l2.known};
+    PerfCounter llcAccess{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES};
+    PerfCounter llcMiss{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES};
+#else
+    PerfCounter l1dAccess{0, 0, false}, l1dMiss{0, 0, false}, l2Access{0, 0, false}, l2Miss{0, 0, false};
+    PerfCounter llcAccess{0, 0, false}, llcMiss{0, 0, false};
+#endif
+    uint64_t l1dAccesses = 0, l1dMisses = 0, l2Accesses = 0, l2Misses = 0, llcAccesses = 0, llcMisses = 0;
+
+    bool available() const { return l1dAccess.available() && l1dMiss.available(); }
+    bool l2Available() const { return l2Access.available() && l2Miss.available(); }
+    bool llcAvailable() const { return llcAccess.available() && llcMiss.available(); }
+
+    void start() {
+        l1dAccess.start();
+        l1dMiss.start();
+        l2Access.start();
+        l2Miss.start();
+        llcAccess.start();
+        llcMiss.start();
+    }
+
+    void stop() {
+        l1dAccesses = l1dAccess.stop();
+        l1dMisses = l1dMiss.stop();
+        l2Accesses = l2Access.stop();
+        l2Misses = l2Miss.stop();
+        llcAccesses = llcAccess.stop();
+        llcMisses = llcMiss.stop();
+    }
+
+    double l1dMissRate() const { return l1dAccesses ? 100.0 * l1dMisses / l1dAccesses : 0.0; }
+    double l2MissRate() const { return l2Accesses ? 100.0 * l2Misses / l2Accesses : 0.0; }
+    double llcMissRate() const { return llcAccesses ? 100.0 * llcMisses / llcAccesses : 0.0; }
+};
+
+// data TLB loads and load misses
+struct TlbCounters {
+#ifdef __linux__
+    PerfCounter loads{PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_ACCESS)};
+    PerfCounter misses{PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)};
+#else
+    PerfCounter loads{0, 0, false}, misses{0, 0, false};
+#endif
+    uint64_t loadCount = 0, missCount = 0;
+
+    bool available() const { return misses.available(); }
+
+    void start() {
+        loads.start();
+        misses.start();
+    }
+
+    void stop() {
+        loadCount = loads.stop();
+        missCount = misses.stop();
+    }
+
+    double missRate() const { return loadCount ? 100.0 * missCount / loadCount : 0.0; }
+};
+
+#endif // PERF_COUNTERS_HPP
@@ -0,0 +1,1066 @@
+// Benchmarks for the SPH solver. Physics only, so it runs without a window or a GL context.
+// usage: SPH_bench [all|grid|alloc|verlet|reorder|pairs|hash|binning|subcell|paircache|compressed|pool|attributes|precision|pages|memory|tiles|threads|gridthreads|balance|simthread|parallel]
+//
+// `alloc` exits with a non-zero status if a warmed-up step touches the heap, `pool` if churn
+// allocates or a reserved store reallocates, `memory` if the solver holds more than its per
+// particle budget, `attributes` if an attribute does not follow its particle, `gridthreads`
+// if a threaded grid build differs from the serial one, `balance` if the stealing passes
+// change the results, `simthread` if a snapshot reaches the render loop torn or out of order,
+// `parallel` if threaded passes drift from the serial ones.
+// `precision` in the default build writes the fp32 reference of its test scene, the same mode
+// in SPH_bench_half (SPH_HALF_STORAGE) compares against it.
+
+#include "sph.hpp"
+#include "simulationThread.hpp"
+#include "alloc_counter.hpp"
+#include "perf_counters.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// n particles jittered around a lattice of spacing `radius` (about 8 per cell, ~30 neighbours
+// inside h, close to a settled pool), the box is sized so the lattice fills it
+void fillSolver(SPHSolver& solver, size_t n, uint32_t seed = 42) {
+    solver.reset();
+    size_t side = static_cast<size_t>(std::ceil(std::cbrt(static_cast<double>(n))));
+    float spacing = solver.radius;
+    solver.boxPos = glm::vec3(0.0f);
+    solver.boxSize = glm::vec3(side * spacing);
+    solver.prevBoxPos = solver.boxPos;
+    solver.prevBoxSize = solver.boxSize;
+
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> jitter(-0.25f * spacing, 0.25f * spacing);
+    glm::vec3 minB = solver.boxPos - solver.boxSize * 0.5f + glm::vec3(0.5f * spacing);
+    for (size_t i = 0; i < n; ++i) {
+        size_t x = i % side, y = (i / side) % side, z = i / (side * side);
+        Particle p;
+        p.position = minB + glm::vec3(x * spacing + jitter(gen), y * spacing + jitter(gen), z * spacing + jitter(gen));
+        p.velocity = glm::vec3(0.0f);
+        solver.particles.push_back(p);
+    }
+    solver.syncParticleArrays();
+    solver.predictePositions(0.001f);
+}
+
+// scrambles the particle order like a while of sloshing would
+void shuffleParticles(SPHSolver& solver, uint32_t seed) {
+    std::mt19937 gen(seed);
+    for (size_t i = solver.particles.size(); i > 1; --i) {
+        size_t j = std::uniform_int_distribution<size_t>(0, i - 1)(gen);
+        Particle a = solver.particles.get(i - 1);
+        solver.particles.set(i - 1, solver.particles.get(j));
+        solver.particles.set(j, a);
+    }
+}
+
+// average wall time of `reps` calls in milliseconds, after one warm-up call
+template <typename F>
+double timeMs(int reps, F&& f) {
+    f();
+    auto start = Clock::now();
+    for (int r = 0; r < reps; ++r) f();
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count() / reps;
+}
+
+// the hash GridCoordHash used to have, xor and shifts
+struct LegacyGridCoordHash {
+    std::size_t operator()(const GridCoord& coord) const {
+        return (std::hash<int>()(coord.x) ^
+                (std::hash<int>()(coord.y) << 1)) >> 1 ^
+                (std::hash<int>()(coord.z) << 1);
+    }
+};
+
+// the unordered_map grid the solver used before the dense grid, kept as the baseline
+struct HashMapGrid {
+    std::unordered_map<GridCoord, std::vector<size_t>, LegacyGridCoordHash> grid;
+
+    void build(const SPHSolver& solver) {
+        grid.clear();
+        for (size_t i = 0; i < solver.particles.size(); ++i) {
+            const glm::vec3 p = solver.particles.predicted.get(i);
+            GridCoord cell;
+            cell.x = static_cast<int>(std::floor(p.x / solver.h));
+            cell.y = static_cast<int>(std::floor(p.y / solver.h));
+            cell.z = static_cast<int>(std::floor(p.z / solver.h));
+            grid[cell].push_back(i);
+        }
+    }
+};
+
+void benchGrid() {
+    std::printf("== grid build ==\n");
+    std::printf("%10s %10s %16s %16s %10s\n", "particles", "cells", "hashmap (ms)", "dense (ms)", "speedup");
+    for (size_t n : {10000u, 100000u, 1000000u}) {
+        SPHSolver solver;
+        fillSolver(solver, n);
+        int reps = n >= 1000000 ? 5 : 20;
+
+        HashMapGrid legacy;
+        double legacyMs = timeMs(reps, [&] { legacy.build(solver); });
+        double denseMs = timeMs(reps, [&] { solver.builGrid(); });
+        std::printf("%10zu %10zu %16.3f %16.3f %9.1fx\n", n, solver.getCellCount(), legacyMs, denseMs, legacyMs / denseMs);
+    }
+}
+
+// a warmed-up step must not touch the heap, returns false if it does
+bool benchAlloc() {
+    std::printf("== heap allocations per step ==\n");
+    std::printf("%20s %12s %18s %16s\n", "config", "allocations", "scratch peak (KiB)", "bytes/particle");
+    const size_t n = 10000;
+    const int warmup = 5, steps = 20;
+    bool ok = true;
+    struct Config { const char* label; NeighbourSearch search; bool symmetric; int reorderInterval; int threads; bool stealing; };
+    for (const Config& config : {Config{"dense grid", NeighbourSearch::DenseGrid, false, 0, 1, false},
+                                 Config{"compact hash", NeighbourSearch::CompactHash, false, 0, 1, false},
+                                 Config{"symmetric pairs", NeighbourSearch::DenseGrid, true, 0, 1, false},
+                                 Config{"reorder every step", NeighbourSearch::DenseGrid, false, 1, 1, false},
+                                 Config{"4 threads", NeighbourSearch::DenseGrid, false, 0, 4, false},
+                                 Config{"4 threads, stealing", NeighbourSearch::DenseGrid, false, 0, 4, true}}) {
+        SPHSolver solver;
+        fillSolver(solver, n);
+        solver.neighbourSearch = config.search;
+        solver.useSymmetricPairs = config.symmetric;
+        solver.reorderInterval = config.reorderInterval;
+        solver.numThreads = config.threads;
+        solver.useWorkStealing = config.stealing;
+        for (int s = 0; s < warmup; ++s) solver.update(0.001f);
+
+        // mapped arrays do not go through operator new, they are counted separately
+        uint64_t mappings = getPageStats().mappings;
+        startCountingAllocations();
+        for (int s = 0; s < steps; ++s) solver.update(0.001f);
+        size_t count = stopCountingAllocations() + (getPageStats().mappings - mappings);
+        size_t peak = solver.getScratchHighWater();
+        std::printf("%20s %12zu %18.1f %16.1f%s\n", config.label, count, peak / 1024.0,
+                    static_cast<double>(peak) / n, count == 0 ? "" : "  FAILED");
+        ok &= count == 0;
+    }
+    return ok;
+}
+
+// step time with the grid search against verlet lists for a few skin sizes
+void benchVerlet() {
+    std::printf("== verlet lists ==\n");
+    std::printf("%12s %12s %10s %14s %10s\n", "search", "ms/step", "rebuilds", "entries/part", "in range");
+    const size_t n = 20000;
+    const int steps = 50;
+    for (float skinFactor : {-1.0f, 0.05f, 0.1f, 0.2f, 0.4f}) {
+        SPHSolver solver;
+        fillSolver(solver, n);
+        solver.useVerletLists = skinFactor >= 0.0f;
+        solver.verletSkin = std::max(skinFactor, 0.0f) * solver.h;
+        double ms = timeMs(steps, [&] { solver.update(0.001f); });
+
+        char label[32];
+        if (solver.useVerletLists) std::snprintf(label, sizeof(label), "skin %.2fh", skinFactor);
+        else std::snprintf(label, sizeof(label), "grid");
+        const VerletStats& stats = solver.verletStats;
+        double entries = static_cast<double>(stats.listEntries) / n;
+        double inRange = stats.listEntries ? 100.0 * stats.pairsInRange / stats.listEntries : 0.0;
+        std::printf("%12s %12.3f %10llu %14.1f %9.1f%%\n", label, ms, (unsigned long long)stats.rebuilds, entries, inRange);
+    }
+}
+
+// a miss rate, or n/a where the counter could not be opened
+void printRate(bool available, double rate) {
+    if (available) std::printf(" %10.2f%%", rate);
+    else std::printf(" %11s", "n/a");
+}
+
+// density + force passes on a scrambled particle order (what the arrays look like after a
+// while of sloshing) against the same particles after a morton reorder. the times are taken
+// without counters, the miss rates over one more pair of passes
+void benchReorder() {
+    std::printf("== morton reorder ==\n");
+    std::printf("%16s %12s %12s %11s %11s %11s\n", "order", "passes (ms)", "step (ms)", "L1d miss", "L2 miss", "LLC miss");
+    const size_t n = 200000;
+    const int reps = 5;
+    for (bool sorted : {false, true}) {
+        SPHSolver solver;
+        fillSolver(solver, n);
+        shuffleParticles(solver, 7);
+        solver.reorderInterval = -1;
+        if (sorted) solver.reorderParticles();
+        solver.predictePositions(0.001f);
+        solver.builGrid();
+
+        auto passes = [&] {
+            solver.computeDensityPressure();
+            solver.computeForces();
+        };
+        double passMs = timeMs(reps, passes);
+        CacheCounters counters;
+        counters.start();
+        passes();
+        counters.stop();
+        double stepMs = timeMs(reps, [&] { solver.update(0.001f); });
+        std::printf("%16s %12.3f %12.3f", sorted ? "morton" : "scrambled", passMs, stepMs);
+        printRate(counters.available(), counters.l1dMissRate());
+        printRate(counters.l2Available(), counters.l2MissRate());
+        printRate(counters.llcAvailable(), counters.llcMissRate());
+        std::printf("\n");
+    }
+}
+
+// full stencil against the half stencil, single threaded and on every core
+void benchPairs() {
+    std::printf("== symmetric pairs ==\n");
+    std::printf("%22s %14s %14s\n", "traversal", "density (ms)", "forces (ms)");
+    const size_t n = 100000;
+    const int reps = 5;
+    int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    struct Config { const char* label; bool symmetric; int threads; };
+    for (const Config& config : {Config{"full stencil", false, 1}, Config{"half stencil", true, 1}, Config{"half stencil, all cores", true, cores}}) {
+        SPHSolver solver;
+        fillSolver(solver, n);
+        solver.useSymmetricPairs = config.symmetric;
+        solver.numThreads = config.threads;
+        solver.builGrid();
+        double densityMs = timeMs(reps, [&] { solver.computeDensityPressure(); });
+        double forcesMs = timeMs(reps, [&] { solver.computeForces(); });
+        std::printf("%22s %14.3f %14.3f\n", config.label, densityMs, forcesMs);
+    }
+}
+
+// dense grid against compact hashing, in the box and with a fifth of the particles
+// sprayed over a domain a hundred times wider than the box
+void benchHash() {
+    std::printf("== neighbour search backends ==\n");
+    std::printf("%8s %8s %12s %12s %14s %12s\n", "scene", "backend", "build (ms)", "passes (ms)", "memory (KiB)", "cells");
+    const size_t n = 100000;
+    const int reps = 3;
+    for (bool spray : {false, true}) {
+        for (NeighbourSearch backend : {NeighbourSearch::DenseGrid, NeighbourSearch::CompactHash}) {
+            SPHSolver solver;
+            fillSolver(solver, n);
+            if (spray) {
+                std::mt19937 gen(3);
+                std::uniform_real_distribution<float> far(-50.0f, 50.0f);
+                glm::vec3 extent = solver.boxSize;
+                for (size_t i = 0; i < n; i += 5) {
+                    solver.particles.position.set(i, glm::vec3(far(gen), far(gen), far(gen)) * extent);
+                }
+                solver.predictePositions(0.001f);
+            }
+            solver.neighbourSearch = backend;
+            double buildMs = timeMs(reps, [&] { solver.builGrid(); });
+            double passMs = timeMs(reps, [&] {
+                solver.computeDensityPressure();
+                solver.computeForces();
+            });
+            std::printf("%8s %8s %12.3f %12.3f %14.1f %12zu\n", spray ? "spray" : "box",
+                        backend == NeighbourSearch::DenseGrid ? "dense" : "hash",
+                        buildMs, passMs, solver.getSearchMemory() / 1024.0, solver.getCellCount());
+        }
+    }
+}
+
+// the grid cell of every particle after a step of up to 2 m/s, two ways: floor of the
+// predicted position over the cell size, and the stored cell plus one where the stored offset
+// moved across a face (what predictedCell does). both write clamped dense cell indices and
+// should agree
+void benchBinning() {
+    std::printf("== binning ==\n");
+    std::printf("%20s %12s %14s\n", "from", "ms/pass", "differing");
+    const size_t n = 1000000;
+    const int reps = 20;
+    const float dt = 0.001f;
+    SPHSolver solver;
+    fillSolver(solver, n);
+    std::mt19937 gen(9);
+    std::uniform_real_distribution<float> speed(-2.0f, 2.0f);
+    for (size_t i = 0; i < n; ++i) solver.particles.velocity.set(i, glm::vec3(speed(gen), speed(gen), speed(gen)));
+    solver.predictePositions(dt);
+    solver.builGrid();
+
+    const CellPositionArray& pos = solver.particles.position;
+    const Vec3Array& predicted = solver.particles.predicted;
+    const BasicVec3Array<StoredFloat>& velocity = solver.particles.velocity;
+    const float cs = pos.cellSize, inv = 1.0f / cs;
+    // the box in cells, one cell of margin like the solver's grid
+    int lo[3], dims[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        lo[axis] = static_cast<int>(std::floor((solver.boxPos[axis] - solver.boxSize[axis] * 0.5f) * inv)) - 1;
+        dims[axis] = static_cast<int>(std::floor((solver.boxPos[axis] + solver.boxSize[axis] * 0.5f) * inv)) + 2 - lo[axis];
+    }
+    auto index = [&](int x, int y, int z) {
+        x = std::clamp(x - lo[0], 0, dims[0] - 1);
+        y = std::clamp(y - lo[1], 0, dims[1] - 1);
+        z = std::clamp(z - lo[2], 0, dims[2] - 1);
+        return static_cast<uint32_t>(x + dims[0] * (y + dims[1] * z));
+    };
+    std::vector<uint32_t> fromPredicted(n), fromCell(n);
+    double floorMs = timeMs(reps, [&] {
+        for (size_t i = 0; i < n; ++i) {
+            fromPredicted[i] = index(static_cast<int>(std::floor(predicted.x[i] * inv)) + pos.frame[0],
+                                     static_cast<int>(std::floor(predicted.y[i] * inv)) + pos.frame[1],
+                                     static_cast<int>(std::floor(predicted.z[i] * inv)) + pos.frame[2]);
+        }
+    });
+    double stepMs = timeMs(reps, [&] {
+        auto step = [&](float offset, StoredFloat v) {
+            float moved = offset + dt * static_cast<float>(v);
+            return (moved >= cs) - (moved < 0.0f);
+        };
+        for (size_t i = 0; i < n; ++i) {
+            fromCell[i] = index(pos.cx[i] + step(pos.offset.x[i], velocity.x[i]), pos.cy[i] + step(pos.offset.y[i], velocity.y[i]),
+                                pos.cz[i] + step(pos.offset.z[i], velocity.z[i]));
+        }
+    });
+    size_t differing = 0;
+    for (size_t i = 0; i < n; ++i) differing += fromPredicted[i] != fromCell[i];
+    std::printf("%20s %12.3f %14s\n", "predicted position", floorMs, "");
+    std::printf("%20s %12.3f %14zu\n", "cell + offset step", stepMs, differing);
+}
+
+// cells of h, h/2 and h/3: candidates tested per particle against those really inside h,
+// the cost of the density + force passes and what the calibration picks
+void benchSubcell() {
+    std::printf("== sub-cell resolution ==\n");
+    std::printf("%10s %10s %12s %12s %12s %12s\n", "cells/h", "stencil", "candidates", "in range", "build (ms)", "passes (ms)");
+    const size_t n = 200000;
+    const int reps = 5;
+    for (int r = 1; r <= MAX_CELLS_PER_H; ++r) {
+        SPHSolver solver;
+        fillSolver(solver, n);
+        solver.cellsPerH = r;
+        solver.cellSize = solver.h / r;
+        double buildMs = timeMs(reps, [&] { solver.builGrid(); });
+
+        size_t candidates = 0, inRange = 0;
+        for (uint32_t i = 0; i < n; ++i) {
+            solver.forEachNeighbour(i, [&](uint32_t j) {
+                glm::vec3 d = solver.particles.predicted.get(i) - solver.particles.predicted.get(j);
+                candidates++;
+                if (glm::dot(d, d) < solver.h * solver.h) inRange++;
+            });
+        }
+        double passMs = timeMs(reps, [&] {
+            solver.computeDensityPressure();
+            solver.computeForces();
+        });
+        std::printf("%10d %10d %12.1f %12.1f %12.3f %12.3f\n", r, solver.stencil->cellCount,
+                    static_cast<double>(candidates) / n, static_cast<double>(inRange) / n, buildMs, passMs);
+    }
+    SPHSolver solver;
+    fillSolver(solver, n);
+    std::printf("calibration picks %d cells per h\n", solver.calibrateCellResolution(0.001f, 3));
+}
+
+// density + force passes searching twice against the pair cache, and with a budget that
+// only holds half of the pairs so the rest spills to the search
+void benchPairCache() {
+    std::printf("== pair cache ==\n");
+    std::printf("%10s %14s %14s %12s %14s\n", "mode", "density (ms)", "forces (ms)", "cache (MiB)", "cached parts");
+    const size_t n = 100000;
+    const int reps = 5;
+    size_t fullBytes = 0;
+    for (int config = 0; config < 3; ++config) {
+        SPHSolver solver;
+        fillSolver(solver, n);
+        solver.usePairCache = config > 0;
+        if (config == 2) solver.pairCacheBudget = fullBytes / 2;
+        solver.builGrid();
+        double densityMs = timeMs(reps, [&] { solver.computeDensityPressure(); });
+        double forcesMs = timeMs(reps, [&] { solver.computeForces(); });
+        const PairCacheStats& stats = solver.pairCacheStats;
+        if (config == 1) fullBytes = stats.pairs * sizeof(CachedPair);
+        const char* label = config == 0 ? "search" : (config == 1 ? "cache" : "spill");
+        std::printf("%10s %14.3f %14.3f %12.1f %14u\n", label, densityMs, forcesMs,
+                    stats.bytes / (1024.0 * 1024.0), stats.cachedParticles);
+    }
+}
+
+// verlet lists as plain indices against 16 bit offsets, on morton sorted particles
+void benchCompressedLists() {
+    std::printf("== compressed verlet lists ==\n");
+    std::printf("%12s %12s %12s %14s %14s %12s\n", "format", "list (MiB)", "bytes/entry", "density (ms)", "forces (ms)", "wide lists");
+    const size_t n = 200000;
+    const int reps = 5;
+    for (bool compressed : {false, true}) {
+        SPHSolver solver;
+        fillSolver(solver, n);
+        shuffleParticles(solver, 7);
+        solver.reorderParticles();
+        solver.predictePositions(0.001f);
+        solver.useVerletLists = true;
+        solver.compressVerletLists = compressed;
+        solver.cellSize = solver.h + solver.verletSkin;
+        solver.builGrid();
+        solver.buildVerletLists();
+
+        double densityMs = timeMs(reps, [&] { solver.computeDensityPressure(); });
+        double forcesMs = timeMs(reps, [&] { solver.computeForces(); });
+        const VerletStats& stats = solver.verletStats;
+        std::printf("%12s %12.1f %12.2f %14.3f %14.3f %12zu\n", compressed ? "16 bit" : "32 bit",
+                    stats.listBytes / (1024.0 * 1024.0), static_cast<double>(stats.listBytes) / stats.listEntries,
+                    densityMs, forcesMs, stats.wideLists);
+    }
+}
+
+// per particle attributes through reorders, compactions, spawns and a copy of the solver:
+// every particle keeps the value tagged to its id, new ones get the initial value. also
+// checks that asking for the wrong type throws and that removing one leaves the rest
+bool benchAttributes() {
+    std::printf("== particle attributes ==\n");
+    const size_t n = 20000;
+    const uint32_t UNTAGGED = UINT32_MAX;
+    SPHSolver solver;
+    fillSolver(solver, n);
+    shuffleParticles(solver, 11);
+    solver.reorderInterval = 1;
+    auto tagOf = [](uint32_t id) { return id * 2654435761u; };
+    AttributeHandle<uint32_t> tag = solver.particles.addAttribute<uint32_t>("tag", UNTAGGED);
+    AttributeHandle<float> temperature = solver.particles.addAttribute<float>("temperature", 20.0f);
+    for (size_t slot = 0; slot < solver.particles.size(); ++slot) solver.particles.attribute(tag)[slot] = tagOf(solver.particleIds[slot]);
+
+    // tagged ids keep their value, spawned ones are untagged
+    std::vector<bool> spawned(n, false);
+    auto verify = [&](SPHSolver& s, const char* stage) {
+        AttributeHandle<uint32_t> found = s.particles.findAttribute<uint32_t>("tag");
+        size_t wrong = 0;
+        for (uint32_t id = 0; id < s.particleSlots.size(); ++id) {
+            if (!s.isAlive(id)) continue;
+            uint32_t expected = id < n && !spawned[id] ? tagOf(id) : UNTAGGED;
+            wrong += !found.valid() || s.particles.attribute(found)[s.particleSlots[id]] != expected;
+        }
+        std::printf("%24s: %zu live, %zu wrong%s\n", stage, s.getLiveCount(), wrong, wrong ? "  FAILED" : "");
+        return wrong == 0;
+    };
+
+    bool ok = true;
+    for (int s = 0; s < 3; ++s) solver.update(0.001f);
+    ok &= verify(solver, "reordered");
+    std::mt19937 gen(13);
+    for (uint32_t id = 0; id < n; ++id) {
+        if (std::uniform_int_distribution<int>(0, 2)(gen) == 0) solver.removeParticle(id);
+    }
+    solver.compactParticles();
+    ok &= verify(solver, "removed, compacted");
+    for (int k = 0; k < 500; ++k) {
+        Particle p;
+        p.position = solver.boxPos;
+        p.velocity = glm::vec3(0.0f);
+        uint32_t id = solver.addParticle(p);
+        if (id < n) spawned[id] = true;
+        else spawned.resize(id + 1, true);
+    }
+    for (int s = 0; s < 3; ++s) solver.update(0.001f);
+    ok &= verify(solver, "spawned, reordered");
+    SPHSolver copy = solver;
+    for (int s = 0; s < 2; ++s) copy.update(0.001f);
+    ok &= verify(copy, "copy");
+
+    bool threw = false;
+    try {
+        solver.particles.findAttribute<float>("tag");
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    std::printf("%24s: %s\n", "wrong type", threw ? "throws" : "does not throw  FAILED");
+    ok &= threw;
+
+    solver.particles.removeAttribute("tag");
+    bool removed = !solver.particles.findAttribute<uint32_t>("tag").valid();
+    solver.update(0.001f);
+    bool kept = solver.particles.findAttribute<float>("temperature").index == temperature.index &&
+                solver.particles.attribute(temperature)[0] == 20.0f;
+    std::printf("%24s: %s\n", "removed", removed && kept ? "gone, others kept" : "FAILED");
+    ok &= removed && kept;
+    return ok;
+}
+
+// an emitter and a sink: a third of the tank is drained, then every step k particles leave
+// and k new ones come in. the pool has to reuse slots and ids without touching the heap.
+// then an emitter alone, with and without the peak count reserved up front: the reserved
+// store must not reallocate its arrays
+bool benchPool() {
+    std::printf("== particle pool ==\n");
+    std::printf("%10s %12s %12s %14s %12s\n", "threshold", "ms/step", "compactions", "fragmentation", "allocations");
+    const size_t n = 20000, k = 200;
+    const int warmup = 5, steps = 40;
+    bool ok = true;
+    for (float threshold : {0.1f, 0.25f, 1.0f}) {
+        SPHSolver solver;
+        fillSolver(solver, n);
+        solver.compactionThreshold = threshold;
+        // travel based reorders compact too, keep them out of the way
+        solver.reorderInterval = 1000000;
+        std::mt19937 gen(3);
+        std::vector<uint32_t> ids;
+        ids.reserve(n);
+        auto churn = [&](size_t remove, size_t add) {
+            ids.clear();
+            for (uint32_t id = 0; id < n; ++id) if (solver.isAlive(id)) ids.push_back(id);
+            for (size_t r = 0; r < remove && !ids.empty(); ++r) {
+                size_t pick = std::uniform_int_distribution<size_t>(0, ids.size() - 1)(gen);
+                solver.removeParticle(ids[pick]);
+                ids[pick] = ids.back();
+                ids.pop_back();
+            }
+            glm::vec3 half = solver.boxSize * 0.45f;
+            std::uniform_real_distribution<float> dx(-half.x, half.x), dz(-half.z, half.z);
+            for (size_t a = 0; a < add; ++a) {
+                Particle p;
+                p.position = solver.boxPos + glm::vec3(dx(gen), half.y, dz(gen));
+                p.velocity = glm::vec3(0.0f);
+                solver.addParticle(p);
+            }
+        };
+        for (int s = 0; s < warmup; ++s) {
+            churn(k, k);
+            solver.update(0.001f);
+        }
+        churn(n / 3, 0);
+        uint64_t before = solver.compactionCount;
+
+        startCountingAllocations();
+        auto start = Clock::now();
+        for (int s = 0; s < steps; ++s) {
+            churn(k, k);
+            solver.update(0.001f);
+        }
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / steps;
+        size_t count = stopCountingAllocations();
+        std::printf("%10.2f %12.3f %12llu %13.1f%% %12zu%s\n", threshold, ms,
+                    (unsigned long long)(solver.compactionCount - before), 100.0f * solver.getFragmentation(), count,
+                    count == 0 ? "" : "  FAILED");
+        ok &= count == 0;
+    }
+
+    std::printf("%10s %12s %14s %16s\n", "emitting", "ms/step", "particles", "reallocations");
+    for (bool reserved : {false, true}) {
+        SPHSolver solver;
+        fillSolver(solver, n);
+        if (reserved) solver.reserveParticles(n + k * steps);
+        uint64_t before = solver.particles.reallocations;
+        std::mt19937 gen(3);
+        glm::vec3 half = solver.boxSize * 0.45f;
+        std::uniform_real_distribution<float> dx(-half.x, half.x), dz(-half.z, half.z);
+        auto start = Clock::now();
+        for (int s = 0; s < steps; ++s) {
+            for (size_t a = 0; a < k; ++a) solver.addParticle({solver.boxPos + glm::vec3(dx(gen), half.y, dz(gen)), glm::vec3(0.0f)});
+            solver.update(0.001f);
+        }
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / steps;
+        uint64_t reallocations = solver.particles.reallocations - before;
+        bool failed = reserved && reallocations != 0;
+        std::printf("%10s %12.3f %14zu %16llu%s\n", reserved ? "reserved" : "growing", ms, solver.getLiveCount(),
+                    (unsigned long long)reallocations, failed ? "  FAILED" : "");
+        ok &= !failed;
+    }
+    return ok;
+}
+
+// bulk state of a run, what a viewer would notice
+struct BulkState {
+    float density;
+    float rmsSpeed;
+    float meanHeight;
+};
+
+BulkState bulkState(const SPHSolver& solver, size_t n) {
+    double speedSq = 0.0, height = 0.0;
+    for (uint32_t id = 0; id < n; ++id) {
+        Particle p = solver.getParticleById(id);
+        speedSq += glm::dot(p.velocity, p.velocity);
+        height += p.position.y;
+    }
+    return {solver.getAverageDensity(), static_cast<float>(std::sqrt(speedSq / n)), static_cast<float>(height / n)};
+}
+
+// a dam break run with the storage of this build. the fp32 build saves its state, a reduced
+// precision build reports how far it ended up from that. single paths are chaotic (fp32
+// rounding alone decorrelates them within a few tens of steps), so particles are compared
+// after `early` steps and the end of the run only in bulk
+bool benchPrecision() {
+    std::printf("== storage precision ==\n");
+    const char* referencePath = "sph_precision_ref.bin";
+    const size_t n = 8000;
+    const int early = 10, steps = 200;
+    SPHSolver solver;
+    fillSolver(solver, n);
+    // the block fills the left half of a box twice as wide
+    solver.boxPos.x += solver.boxSize.x * 0.5f;
+    solver.boxSize.x *= 2.0f;
+    solver.prevBoxPos = solver.boxPos;
+    solver.prevBoxSize = solver.boxSize;
+
+    std::vector<Particle> state(n);
+    auto start = Clock::now();
+    for (int s = 0; s < steps; ++s) {
+        solver.update(0.001f);
+        if (s + 1 != early) continue;
+        for (uint32_t id = 0; id < n; ++id) state[id] = solver.getParticleById(id);
+    }
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / steps;
+    BulkState bulk = bulkState(solver, n);
+
+    const bool half = !std::is_same_v<StoredFloat, float>;
+    // everything the store holds per particle, both generations and the padding included
+    const size_t bytes = solver.particles.sizeBytes() / n;
+    if (!half) {
+        std::printf("%16s %16s %12s\n", "storage", "bytes/particle", "ms/step");
+        std::printf("%16s %16zu %12.3f\n", "fp32", bytes, ms);
+        FILE* file = std::fopen(referencePath, "wb");
+        if (!file) return false;
+        std::fwrite(&bytes, sizeof(bytes), 1, file);
+        std::fwrite(&bulk, sizeof(bulk), 1, file);
+        std::fwrite(state.data(), sizeof(Particle), n, file);
+        std::fclose(file);
+        std::printf("wrote the fp32 reference to %s\n", referencePath);
+        return true;
+    }
+
+    std::vector<Particle> reference(n);
+    BulkState referenceBulk{};
+    size_t referenceBytes = 0;
+    FILE* file = std::fopen(referencePath, "rb");
+    bool loaded = file && std::fread(&referenceBytes, sizeof(referenceBytes), 1, file) == 1 &&
+                  std::fread(&referenceBulk, sizeof(referenceBulk), 1, file) == 1 &&
+                  std::fread(reference.data(), sizeof(Particle), n, file) == n;
+    if (file) std::fclose(file);
+    if (!loaded) {
+        std::printf("no reference in %s, run SPH_bench precision first\n", referencePath);
+        return false;
+    }
+    std::printf("%16s %16s %16s %12s\n", "storage", "bytes/particle", "fp32 bytes", "ms/step");
+    std::printf("%16s %16zu %16zu %12.3f\n", "fp16", bytes, referenceBytes, ms);
+    double posSq = 0.0, posMax = 0.0, velSq = 0.0, speedSq = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        double dp = glm::length(state[i].position - reference[i].position);
+        posSq += dp * dp;
+        posMax = std::max(posMax, dp);
+        glm::vec3 dv = state[i].velocity - reference[i].velocity;
+        velSq += glm::dot(dv, dv);
+        speedSq += glm::dot(reference[i].velocity, reference[i].velocity);
+    }
+    auto relative = [](float a, float b) { return std::abs(a - b) / std::max(std::abs(b), 1e-6f); };
+    std::printf("after %d steps: rms position %.2e h, max position %.2e h, rms velocity %.2e (relative)\n", early,
+                std::sqrt(posSq / n) / solver.h, posMax / solver.h, std::sqrt(velSq / std::max(speedSq, 1e-12)));
+    std::printf("after %d steps: density %.2e, rms speed %.2e, mean height %.2e h (relative, height absolute)\n",
+                steps, relative(bulk.density, referenceBulk.density), relative(bulk.rmsSpeed, referenceBulk.rmsSpeed),
+                std::abs(bulk.meanHeight - referenceBulk.meanHeight) / solver.h);
+    return true;
+}
+
+// step time and data TLB misses with the particle arrays on 4 KiB pages, huge pages and
+// huge pages first touched by the pool workers, each under its own slice of the particles.
+// on one socket first touch changes nothing
+void benchPages() {
+    std::printf("== page policy ==\n");
+    std::printf("%24s %12s %16s %10s %12s\n", "policy", "ms/step", "dTLB miss/step", "miss rate", "hugetlb");
+    const size_t n = 300000;
+    const int steps = 3;
+    int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    struct Config { const char* label; HugePages hugePages; bool firstTouch; };
+    for (const Config& config : {Config{"4 KiB pages", HugePages::Off, false},
+                                 Config{"transparent", HugePages::Transparent, false},
+                                 Config{"transparent, first touch", HugePages::Transparent, true},
+                                 Config{"explicit, first touch", HugePages::Explicit, true}}) {
+        SPHSolver solver;
+        solver.numThreads = cores;
+        solver.useSymmetricPairs = true;
+        solver.setPagePolicy(config.hugePages, config.firstTouch);
+        PageStats before = getPageStats();
+        fillSolver(solver, n);
+        solver.update(0.001f);
+
+        TlbCounters counters;
+        counters.start();
+        double ms = timeMs(steps, [&] { solver.update(0.001f); });
+        counters.stop();
+        PageStats after = getPageStats();
+        char hugetlb[32];
+        if (config.hugePages != HugePages::Explicit) std::snprintf(hugetlb, sizeof(hugetlb), "-");
+        else std::snprintf(hugetlb, sizeof(hugetlb), "%llu/%llu", (unsigned long long)(after.explicitMappings - before.explicitMappings),
+                           (unsigned long long)(after.explicitMappings - before.explicitMappings + after.explicitFallbacks - before.explicitFallbacks));
+        if (counters.available()) {
+            std::printf("%24s %12.3f %16.0f %9.3f%% %12s\n", config.label, ms, static_cast<double>(counters.missCount) / (steps + 1),
+                        counters.missRate(), hugetlb);
+        } else {
+            std::printf("%24s %12.3f %16s %10s %12s\n", config.label, ms, "n/a", "n/a", hugetlb);
+        }
+    }
+    setPagePolicy({});
+}
+
+// size of the data or unified cache of that level on cpu 0, 0 if it is not known
+size_t cacheBytes(int level) {
+    for (int index = 0; index < 16; ++index) {
+        std::string dir = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/";
+        std::ifstream levelFile(dir + "level"), typeFile(dir + "type"), sizeFile(dir + "size");
+        int cacheLevel = 0;
+        std::string type, size;
+        if (!(levelFile >> cacheLevel) || !(typeFile >> type) || !(sizeFile >> size)) break;
+        if (cacheLevel != level || type == "Instruction") continue;
+        size_t bytes = std::stoul(size);
+        if (size.back() == 'K') bytes <<= 10;
+        else if (size.back() == 'M') bytes <<= 20;
+        return bytes;
+    }
+    return 0;
+}
+
+// density + force passes untiled and with tiles of 2^3..16^3 cells. "candidates" is a model:
+// candidates tested times the bytes read per candidate, from the particle arrays untiled and
+// from the tile copy tiled (the halo covers the stencil, so the count is the same). "gathered"
+// is counted, the bytes copied from the particle arrays into tiles. "largest" is the biggest
+// single tile copy, which has to fit a core's cache for the tile to pay. "LLC traffic" is
+// measured, last level cache misses times 64 B, and the only column that shows memory
+// traffic saved. tiling can only win once the particle arrays outgrow the last level cache
+void benchTiles() {
+    std::printf("== cache blocked tiles ==\n");
+    const size_t n = 300000;
+    const int reps = 5;
+    const double kib = 1024.0;
+    std::printf("L2 %.0f KiB, LLC %.0f KiB (0 if unknown)\n", cacheBytes(2) / kib, cacheBytes(3) / kib);
+    std::printf("%16s %12s %17s %14s %14s %11s %18s\n", "tile", "passes (ms)", "candidates (MiB)", "gathered (MiB)",
+                "largest (KiB)", "L1d miss", "LLC traffic (MiB)");
+    // slot and predicted position, then velocity, density and pressure
+    const size_t densityBytes = 4 * sizeof(float), forceBytes = densityBytes + 5 * sizeof(StoredFloat);
+    const double mib = 1024.0 * 1024.0;
+    for (int edge : {0, 2, 4, 8, 16}) {
+        SPHSolver solver;
+        fillSolver(solver, n);
+        shuffleParticles(solver, 7);
+        solver.reorderParticles();
+        solver.predictePositions(0.001f);
+        solver.builGrid();
+        solver.useTiles = edge > 0;
+        solver.tileCells = edge;
+
+        CacheCounters counters;
+        counters.start();
+        double passMs = timeMs(reps, [&] {
+            solver.computeDensityPressure();
+            solver.computeForces();
+        });
+        counters.stop();
+
+        size_t candidates = 0;
+        for (uint32_t i = 0; i < solver.particles.size(); ++i) solver.forEachGridNeighbour(i, [&](uint32_t) { candidates++; });
+        double candidateBytes = static_cast<double>(candidates) * (densityBytes + forceBytes);
+        char label[32];
+        if (edge == 0) std::snprintf(label, sizeof(label), "untiled");
+        else std::snprintf(label, sizeof(label), "%d^3 cells", edge);
+        // the stats are of the last pair of passes, the counters ran over the warm-up one too
+        double gatheredBytes = static_cast<double>(solver.tileStats.gatheredBytes);
+        // untiled, the whole particle store is the working set
+        double largestBytes = edge > 0 ? static_cast<double>(solver.tileStats.largestTileBytes) : static_cast<double>(solver.particles.sizeBytes());
+        if (counters.available()) {
+            std::printf("%16s %12.3f %17.1f %14.1f %14.1f %10.2f%% %18.1f\n", label, passMs, candidateBytes / mib, gatheredBytes / mib,
+                        largestBytes / kib, counters.l1dMissRate(), counters.llcMisses * 64.0 / (reps + 1) / mib);
+        } else {
+            std::printf("%16s %12.3f %17.1f %14.1f %14.1f %11s %18s\n", label, passMs, candidateBytes / mib, gatheredBytes / mib,
+                        largestBytes / kib, "n/a", "n/a");
+        }
+    }
+}
+
+// whole steps on the solver's pool for 1, 2, 4... threads up to every core
+void benchThreads() {
+    std::printf("== thread pool ==\n");
+    std::printf("%8s %12s %10s\n", "threads", "ms/step", "speedup");
+    const size_t n = 200000;
+    const int steps = 5;
+    int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    SPHSolver solver;
+    fillSolver(solver, n);
+    double serialMs = 0.0;
+    for (int threads = 1;; threads = std::min(threads * 2, cores)) {
+        solver.numThreads = threads;
+        double ms = timeMs(steps, [&] { solver.update(0.001f); });
+        if (threads == 1) serialMs = ms;
+        std::printf("%8d %12.3f %9.2fx\n", threads, ms, serialMs / ms);
+        if (threads == cores) break;
+    }
+}
+
+// full dense grid builds of 1M particles for 1, 2, 4... threads up to every core (at least
+// 16, past the cores the threads share them), fails if the grid differs from the serial one
+bool benchGridThreads() {
+    std::printf("== threaded grid build ==\n");
+    std::printf("%8s %12s %10s %11s\n", "threads", "ms/build", "speedup", "efficiency");
+    const size_t n = 1000000;
+    const int reps = 10;
+    int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    int maxThreads = std::max(cores, 16);
+    SPHSolver solver;
+    fillSolver(solver, n);
+    shuffleParticles(solver, 7);
+    solver.numThreads = 1;
+    solver.builGrid();
+    std::vector<uint32_t> serialStart = solver.cellStart, serialIndices = solver.sortedIndices;
+
+    bool ok = true;
+    double serialMs = 0.0;
+    for (int threads = 1;; threads = std::min(threads * 2, maxThreads)) {
+        solver.numThreads = threads;
+        double ms = timeMs(reps, [&] { solver.builGrid(); });
+        if (threads == 1) serialMs = ms;
+        bool same = solver.cellStart == serialStart && solver.sortedIndices == serialIndices;
+        double speedup = serialMs / ms;
+        std::printf("%8d %12.3f %9.2fx %10.0f%%%s%s\n", threads, ms, speedup, 100.0 * speedup / threads,
+                    threads > cores ? "  (oversubscribed)" : "", same ? "" : "  FAILED");
+        ok &= same;
+        if (threads == maxThreads) break;
+    }
+    return ok;
+}
+
+// a dam break: the particles of fillSolver piled into one corner of a box three times as
+// wide, so most cells are empty. density and force passes split by particle ranges against
+// the cell blocks of the stealing scheduler, with the busy and idle time of every thread
+bool benchBalance() {
+    std::printf("== work stealing, dam break ==\n");
+    const size_t n = 100000;
+    const int steps = 5;
+    const int threads = static_cast<int>(std::max(4u, std::thread::hardware_concurrency()));
+    SPHSolver solver;
+    fillSolver(solver, n);
+    solver.boxPos += solver.boxSize;
+    solver.boxSize *= 3.0f;
+    solver.prevBoxPos = solver.boxPos;
+    solver.prevBoxSize = solver.boxSize;
+    solver.numThreads = threads;
+    for (int s = 0; s < 5; ++s) solver.update(0.001f);
+
+    std::vector<float> results[2];
+    for (int stealing = 0; stealing < 2; ++stealing) {
+        solver.useWorkStealing = stealing == 1;
+        double ms = timeMs(steps, [&] {
+            solver.computeDensityPressure();
+            solver.computeForces();
+        });
+        for (size_t i = 0; i < n; ++i) {
+            glm::vec3 f = solver.particles.force.get(i);
+            results[stealing].insert(results[stealing].end(), {solver.particles.density[i], f.x, f.y, f.z});
+        }
+        std::printf("%s: %.3f ms for density and forces on %d threads\n", stealing ? "cell blocks, stealing" : "particle ranges",
+                    ms, threads);
+        if (!stealing) continue;
+        // stats of the timed passes and the warm-up one
+        const std::vector<WorkerStats>& workers = solver.getWorkerStats();
+        double busiest = 0.0, busy = 0.0;
+        std::printf("%8s %10s %10s %8s %8s\n", "thread", "busy ms", "idle ms", "blocks", "steals");
+        for (size_t t = 0; t < workers.size(); ++t) {
+            std::printf("%8zu %10.3f %10.3f %8llu %8llu\n", t, workers[t].busyMs, workers[t].idleMs,
+                        (unsigned long long)workers[t].tasks, (unsigned long long)workers[t].steals);
+            busiest = std::max(busiest, workers[t].busyMs);
+            busy += workers[t].busyMs;
+        }
+        std::printf("busiest thread %.2fx the mean\n", busy > 0.0 ? busiest * workers.size() / busy : 1.0);
+    }
+    bool same = results[0] == results[1];
+    if (!same) std::printf("stealing changed the results  FAILED\n");
+    return same;
+}
+
+// the solver on its own thread (and its pool) against a 60 Hz render loop that takes the
+// latest snapshot and edits a setting now and then, like the UI does. fails if a snapshot is
+// incomplete or older than the one before it, or an edit never shows up in one
+bool benchSimulationThread() {
+    std::printf("== simulation thread ==\n");
+    const size_t n = 20000;
+    const int frames = 120;
+    const int threads = static_cast<int>(std::max(4u, std::thread::hardware_concurrency()));
+    SPHSolver solver;
+    fillSolver(solver, n);
+    solver.numThreads = threads;
+    const glm::vec3 boxPos = solver.boxPos, boxSize = solver.boxSize;
+    SimulationThread simulation(solver);
+    simulation.start();
+
+    bool ok = true;
+    int fresh = 0;
+    uint64_t lastStep = simulation.snapshot().step;
+    float viscosity = 0.0f;
+    double acquireMs = 0.0, editMs = 0.0;
+    auto start = Clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        auto frameStart = Clock::now();
+        simulation.setBox(boxPos, boxSize);
+        bool acquired = simulation.acquireSnapshot();
+        simulation.requestStats();
+        const ParticleSnapshot& snapshot = simulation.snapshot();
+        acquireMs = std::max(acquireMs, std::chrono::duration<double, std::milli>(Clock::now() - frameStart).count());
+        if (acquired) {
+            fresh++;
+            if (snapshot.particles.size() != n || snapshot.stats.liveCount != n || snapshot.step <= lastStep) ok = false;
+            lastStep = snapshot.step;
+        }
+        if (frame % 10 == 0) {
+            auto editStart = Clock::now();
+            SolverSettings settings = simulation.getSettings();
+            settings.viscosity = viscosity = frame % 20 == 0 ? 0.01f : 0.011f;
+            simulation.setSettings(settings);
+            simulation.post(SolverCommand::Stop);
+            editMs = std::max(editMs, std::chrono::duration<double, std::milli>(Clock::now() - editStart).count());
+        }
+        std::this_thread::sleep_until(frameStart + std::chrono::microseconds(1000000 / 60));
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    // the step in flight may have taken its inputs before the last edit, the one after has it
+    uint64_t editedStep = simulation.getStepCount() + 2;
+    while (simulation.snapshot().step < editedStep) {
+        simulation.acquireSnapshot();
+        std::this_thread::yield();
+    }
+    if (simulation.snapshot().settings.viscosity != viscosity || simulation.getSettings().viscosity != viscosity) ok = false;
+    simulation.stop();
+
+    std::printf("render: %.1f fps, %d new snapshots, longest acquire %.4f ms, longest edit %.4f ms\n", frames / seconds, fresh,
+                acquireMs, editMs);
+    std::printf("simulation: %d threads, %.1f steps/s (%llu steps, %.2f ms/step)\n", threads, simulation.getStepCount() / seconds,
+                (unsigned long long)simulation.getStepCount(), simulation.getStepMs());
+    if (!ok) std::printf("a snapshot was incomplete or out of order, or missed an edit  FAILED\n");
+    return ok;
+}
+
+// density and forces on one thread against every core, fails past PARALLEL_TOLERANCE. built
+// with SPH_TSAN this is also the ThreadSanitizer run of the threaded passes
+bool benchParallel() {
+    std::printf("== threaded passes against serial ==\n");
+    std::printf("%16s %8s %14s %14s\n", "passes", "threads", "density diff", "force diff");
+    const size_t n = 20000;
+    const int threads = static_cast<int>(std::max(4u, std::thread::hardware_concurrency()));
+    struct Config { const char* label; bool symmetric, tiles, pairCache, verlet, stealing, firstTouch; NeighbourSearch search; };
+    bool ok = true;
+    for (const Config& config : {Config{"dense grid", false, false, false, false, false, false, NeighbourSearch::DenseGrid},
+                                 Config{"compact hash", false, false, false, false, false, false, NeighbourSearch::CompactHash},
+                                 Config{"verlet lists", false, false, false, true, false, false, NeighbourSearch::DenseGrid},
+                                 Config{"pair cache", false, false, true, false, false, false, NeighbourSearch::DenseGrid},
+                                 Config{"tiles", false, true, false, false, false, false, NeighbourSearch::DenseGrid},
+                                 Config{"work stealing", false, false, false, false, true, false, NeighbourSearch::DenseGrid},
+                                 Config{"symmetric", true, false, false, false, false, false, NeighbourSearch::DenseGrid},
+                                 Config{"first touch", false, false, false, false, false, true, NeighbourSearch::DenseGrid},
+                                 Config{"first touch, sym", true, false, false, false, false, true, NeighbourSearch::DenseGrid}}) {
+        SPHSolver solver;
+        // static slices of the capacity instead of dynamic chunks
+        solver.setPagePolicy(HugePages::Default, config.firstTouch);
+        fillSolver(solver, n);
+        solver.useSymmetricPairs = config.symmetric;
+        solver.useTiles = config.tiles;
+        solver.usePairCache = config.pairCache;
+        solver.useVerletLists = config.verlet;
+        solver.useWorkStealing = config.stealing;
+        solver.neighbourSearch = config.search;
+        // a few threaded steps so the particles move off the lattice, and the other stages
+        // run under the sanitizer too
+        solver.numThreads = threads;
+        for (int s = 0; s < 5; ++s) solver.update(0.001f);
+
+        std::vector<float> density[2], force[2];
+        for (int run = 0; run < 2; ++run) {
+            solver.numThreads = run == 0 ? 1 : threads;
+            solver.computeDensityPressure();
+            solver.computeForces();
+            for (size_t i = 0; i < n; ++i) {
+                density[run].push_back(solver.particles.density[i]);
+                glm::vec3 f = solver.particles.force.get(i);
+                force[run].insert(force[run].end(), {f.x, f.y, f.z});
+            }
+        }
+        auto relativeDiff = [](const std::vector<float>& a, const std::vector<float>& b) {
+            float largest = 0.0f, diff = 0.0f;
+            for (size_t k = 0; k < a.size(); ++k) {
+                largest = std::max(largest, std::abs(a[k]));
+                diff = std::max(diff, std::abs(a[k] - b[k]));
+            }
+            return largest > 0.0f ? diff / largest : diff;
+        };
+        float densityDiff = relativeDiff(density[0], density[1]), forceDiff = relativeDiff(force[0], force[1]);
+        bool within = densityDiff <= SPHSolver::PARALLEL_TOLERANCE && forceDiff <= SPHSolver::PARALLEL_TOLERANCE;
+        std::printf("%16s %8d %14.3g %14.3g%s\n", config.label, threads, densityDiff, forceDiff, within ? "" : "  FAILED");
+        ok &= within;
+    }
+    setPagePolicy({});
+    return ok;
+}
+
+// held bytes per particle of each solver component after a few steps, fails if a component
+// holds less than it uses or the solver goes over MEMORY_BUDGET bytes per particle
+bool benchMemory() {
+    std::printf("== memory ==\n");
+    const size_t n = 100000;
+    const size_t MEMORY_BUDGET = 1024;
+    struct Config { const char* label; bool verlet, compressed, symmetric, pairCache, hash; };
+    bool ok = true;
+    for (const Config& config : {Config{"dense grid", false, false, false, false, false},
+                                 Config{"compact hash", false, false, false, false, true},
+                                 Config{"verlet, compressed", true, true, false, false, false},
+                                 Config{"pair cache", false, false, false, true, false},
+                                 Config{"symmetric, 4 threads", false, false, true, false, false}}) {
+        SPHSolver solver;
+        fillSolver(solver, n);
+        solver.useVerletLists = config.verlet;
+        solver.compressVerletLists = config.compressed;
+        solver.useSymmetricPairs = config.symmetric;
+        solver.numThreads = config.symmetric ? 4 : 1;
+        solver.usePairCache = config.pairCache;
+        if (config.hash) solver.neighbourSearch = NeighbourSearch::CompactHash;
+        for (int s = 0; s < 5; ++s) solver.update(0.001f);
+
+        MemoryReport report = solver.getMemoryReport();
+        std::printf("%s: %.1f MiB used, %.1f MiB held, %.0f B/particle\n", config.label,
+                    report.totalBytes() / (1024.0 * 1024.0), report.totalCapacity() / (1024.0 * 1024.0),
+                    static_cast<double>(report.totalCapacity()) / n);
+        for (const MemoryEntry& entry : report.entries) {
+            if (entry.capacity == 0) continue;
+            bool consistent = entry.bytes <= entry.capacity;
+            std::printf("  %-12s %10.1f KiB %10.1f KiB held%s\n", entry.name.c_str(), entry.bytes / 1024.0,
+                        entry.capacity / 1024.0, consistent ? "" : "  FAILED");
+            ok &= consistent;
+        }
+        if (report.totalCapacity() > MEMORY_BUDGET * n) {
+            std::printf("  over the budget of %zu B/particle  FAILED\n", MEMORY_BUDGET);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string mode = argc > 1 ? argv[1] : "all";
+    bool ok = true;
+    if (mode == "all" || mode == "grid") benchGrid();
+    if (mode == "all" || mode == "alloc") ok &= benchAlloc();
+    if (mode == "all" || mode == "verlet") benchVerlet();
+    if (mode == "all" || mode == "reorder") benchReorder();
+    if (mode == "all" || mode == "pairs") benchPairs();
+    if (mode == "all" || mode == "hash") benchHash();
+    if (mode == "all" || mode == "binning") benchBinning();
+    if (mode == "all" || mode == "subcell") benchSubcell();
+    if (mode == "all" || mode == "paircache") benchPairCache();
+    if (mode == "all" || mode == "compressed") benchCompressedLists();
+    if (mode == "all" || mode == "pool") ok &= benchPool();
+    if (mode == "all" || mode == "attributes") ok &= benchAttributes();
+    if (mode == "precision") ok &= benchPrecision();
+    if (mode == "all" || mode == "pages") benchPages();
+    if (mode == "all" || mode == "memory") ok &= benchMemory();
+    if (mode == "all" || mode == "tiles") benchTiles();
+    if (mode == "all" || mode == "threads") benchThreads();
+    if (mode == "all" || mode == "gridthreads") ok &= benchGridThreads();
+    if (mode == "all" || mode == "balance") ok &= benchBalance();
+    if (mode == "all" || mode == "simthread") ok &= benchSimulationThread();
+    if (mode == "all" || mode == "parallel") ok &= benchParallel();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+#ifndef HALF_HPP
+#define HALF_HPP
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+// ieee 754 binary16, only used to store values. it turns into a float when read and is
+// rounded back when written, all the math in the kernels stays in float
+struct Half {
+    uint16_t bits = 0;
+
+    Half() = default;
+    explicit Half(float f) : bits(fromFloat(f)) {}
+    Half& operator=(float f) {
+        bits = fromFloat(f);
+        return *this;
+    }
+    Half& operator+=(float f) { return *this = static_cast<float>(*this) + f; }
+    operator float() const { return toFloat(bits); }
+
+    static uint16_t fromFloat(float f) {
+#if defined(__F16C__)
+        return static_cast<uint16_t>(_cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT));
+#else
+        uint32_t x;
+        std::memcpy(&x, &f, sizeof(x));
+        uint32_t sign = (x >> 16) & 0x8000u;
+        uint32_t abs = x & 0x7fffffffu;
+        // nan stays nan, inf and everything from 65520 up becomes inf
+        if (abs > 0x7f800000u) return static_cast<uint16_t>(sign | 0x7e00u);
+        if (abs >= 0x477ff000u) return static_cast<uint16_t>(sign | 0x7c00u);
+        if (abs < 0x38800000u) {
+            // subnormal: adding 0.5 lines the mantissa up with steps of 2^-24 and rounds
+            float a;
+            std::memcpy(&a, &abs, sizeof(a));
+            a += 0.5f;
+            uint32_t r;
+            std::memcpy(&r, &a, sizeof(r));
+            return static_cast<uint16_t>(sign | (r - 0x3f000000u));
+        }
+        // rebias the exponent and round to nearest even
+        abs += 0xc8000fffu + ((abs >> 13) & 1u);
+        return static_cast<uint16_t>(sign | (abs >> 13));
+#endif
+    }
+
+    static float toFloat(uint16_t h) {
+#if defined(__F16C__)
+        return _cvtsh_ss(h);
+#else
+        uint32_t sign = static_cast<uint32_t>(h & 0x8000u) << 16;
+        uint32_t abs = h & 0x7fffu;
+        uint32_t bits;
+        if (abs >= 0x7c00u) {
+            bits = 0x7f800000u | ((abs & 0x3ffu) << 13);
+        } else if (abs >= 0x0400u) {
+            bits = (abs << 13) + 0x38000000u;
+        } else {
+            float f = static_cast<float>(abs) * 5.9604645e-8f;
+            std::memcpy(&bits, &f, sizeof(bits));
+        }
+        bits |= sign;
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+#endif
+    }
+};
+
+#endif // HALF_HPP
@@ -0,0 +1,53 @@
+#ifndef MEMORY_REPORT_HPP
+#define MEMORY_REPORT_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// bytes a component uses and the bytes it holds (capacity of its containers, size of its GPU
+// buffers). capacity >= bytes, the difference is what it could grow into without allocating
+struct MemoryEntry {
+    std::string name;
+    size_t bytes = 0;
+    size_t capacity = 0;
+};
+
+// flat list of components, names of nested components are joined with '/' ("solver/grid")
+struct MemoryReport {
+    std::vector<MemoryEntry> entries;
+
+    void add(const std::string& name, size_t bytes, size_t capacity) { entries.push_back({name, bytes, capacity}); }
+    // keeps the room for the entries, so refilling a report of short names does not allocate
+    void clear() { entries.clear(); }
+    // adds every entry of other under prefix
+    void append(const std::string& prefix, const MemoryReport& other) {
+        for (const MemoryEntry& entry : other.entries) add(prefix + "/" + entry.name, entry.bytes, entry.capacity);
+    }
+
+    // nullptr if there is no such entry
+    const MemoryEntry* find(const std::string& name) const {
+        for (const MemoryEntry& entry : entries) {
+            if (entry.name == name) return &entry;
+        }
+        return nullptr;
+    }
+
+    // sums over the entries named prefix or starting with prefix + "/", everything for ""
+    size_t totalBytes(const std::string& prefix = "") const { return total(prefix, &MemoryEntry::bytes); }
+    size_t totalCapacity(const std::string& prefix = "") const { return total(prefix, &MemoryEntry::capacity); }
+
+private:
+    size_t total(const std::string& prefix, size_t MemoryEntry::*field) const {
+        size_t sum = 0;
+        for (const MemoryEntry& entry : entries) {
+            bool inside = prefix.empty() || entry.name == prefix ||
+                          (entry.name.size() > prefix.size() && entry.name.compare(0, prefix.size(), prefix) == 0 &&
+                           entry.name[prefix.size()] == '/');
+            if (inside) sum += entry.*field;
+        }
+        return sum;
+    }
+};
+
+#endif // MEMORY_REPORT_HPP
@@ -0,0 +1,109 @@
+#include "pageAllocator.hpp"
+
+#include <atomic>
+#include <fstream>
+#include <new>
+#include <string>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr size_t HUGE_PAGE = size_t(2) << 20;
+
+PagePolicy policy;
+std::atomic<size_t> mappedBytes{0};
+std::atomic<uint64_t> mappings{0};
+std::atomic<uint64_t> explicitMappings{0};
+std::atomic<uint64_t> explicitFallbacks{0};
+
+size_t mappingSize(size_t bytes) {
+    return (bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+}
+
+#ifdef __linux__
+// false if transparent huge pages are set to never, then MADV_HUGEPAGE has no effect
+bool transparentHugePagesEnabled() {
+    static const bool enabled = [] {
+        std::ifstream file("/sys/kernel/mm/transparent_hugepage/enabled");
+        std::string setting;
+        return std::getline(file, setting) && setting.find("[never]") == std::string::npos;
+    }();
+    return enabled;
+}
+
+void* mapAligned(size_t size) {
+    // over-map by a huge page and trim both ends, so the range can be backed by huge pages
+    size_t padded = size + HUGE_PAGE;
+    void* mapped = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) throw std::bad_alloc();
+    std::byte* raw = static_cast<std::byte*>(mapped);
+    std::byte* aligned = reinterpret_cast<std::byte*>((reinterpret_cast<uintptr_t>(raw) + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE);
+    if (aligned > raw) munmap(raw, aligned - raw);
+    size_t tail = (raw + padded) - (aligned + size);
+    if (tail > 0) munmap(aligned + size, tail);
+    return aligned;
+}
+#endif
+
+} // namespace
+
+void setPagePolicy(const PagePolicy& newPolicy) {
+    policy = newPolicy;
+}
+
+const PagePolicy& getPagePolicy() {
+    return policy;
+}
+
+PageStats getPageStats() {
+    return {mappedBytes.load(), mappings.load(), explicitMappings.load(), explicitFallbacks.load()};
+}
+
+void* allocatePages(size_t bytes, bool partitioned) {
+    size_t size = mappingSize(bytes);
+    mappings++;
+#ifdef __linux__
+    void* data = MAP_FAILED;
+    // the page size the mapping is known to be backed with, the first touch has to write to
+    // every one of them. without madvise even a THP=always kernel may leave parts on small
+    // pages, so only a hugetlb mapping or a successful MADV_HUGEPAGE count as huge
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    if (policy.hugePages == HugePages::Explicit) {
+        data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data == MAP_FAILED) explicitFallbacks++;
+        else {
+            explicitMappings++;
+            pageSize = HUGE_PAGE;
+        }
+    }
+    if (data == MAP_FAILED) {
+        data = mapAligned(size);
+        if (policy.hugePages == HugePages::Off) madvise(data, size, MADV_NOHUGEPAGE);
+        else if (policy.hugePages != HugePages::Default && madvise(data, size, MADV_HUGEPAGE) == 0 &&
+                 transparentHugePagesEnabled()) {
+            pageSize = HUGE_PAGE;
+        }
+    }
+    mappedBytes += size;
+    if (partitioned && policy.firstTouch) policy.firstTouch(static_cast<std::byte*>(data), bytes, pageSize);
+    return data;
+#else
+    (void)partitioned;
+    mappedBytes += size;
+    return ::operator new(size, std::align_val_t(HUGE_PAGE));
+#endif
+}
+
+void freePages(void* data, size_t bytes) {
+    size_t size = mappingSize(bytes);
+    mappedBytes -= size;
+#ifdef __linux__
+    munmap(data, size);
+#else
+    ::operator delete(data, std::align_val_t(HUGE_PAGE));
+#endif
+}
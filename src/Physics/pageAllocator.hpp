@@ -0,0 +1,46 @@
+#ifndef PAGE_ALLOCATOR_HPP
+#define PAGE_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// how the pages of the big particle arrays are backed. only has an effect on linux,
+// elsewhere large allocations are plain aligned new
+enum class HugePages {
+    Default,     // whatever the kernel does (transparent_hugepage setting)
+    Off,         // MADV_NOHUGEPAGE, 4 KiB pages only
+    Transparent, // MADV_HUGEPAGE on 2 MiB aligned ranges
+    Explicit,    // MAP_HUGETLB from the reserved pool, transparent if the pool is empty
+};
+
+struct PagePolicy {
+    HugePages hugePages = HugePages::Default;
+    // writes every page of a new partitioned mapping once, given the mapping, the bytes asked
+    // for and the page size it is backed with. the kernel puts a page on the node of the
+    // thread that writes it first. runs on the allocating thread, empty leaves the first touch
+    // to whoever writes first (see SPHSolver::setPagePolicy)
+    std::function<void(std::byte* data, size_t bytes, size_t pageSize)> firstTouch;
+};
+
+struct PageStats {
+    size_t mappedBytes = 0;        // currently mapped through allocatePages
+    uint64_t mappings = 0;         // allocatePages calls so far
+    uint64_t explicitMappings = 0; // MAP_HUGETLB mappings that succeeded
+    uint64_t explicitFallbacks = 0;
+};
+
+// allocations from this size on go through allocatePages
+constexpr size_t LARGE_ALLOCATION = size_t(2) << 20;
+
+// applies to allocations made after the call, set it before the arrays grow (or copy them)
+void setPagePolicy(const PagePolicy& policy);
+const PagePolicy& getPagePolicy();
+PageStats getPageStats();
+
+// maps at least `bytes`, 2 MiB aligned. `partitioned` mappings are first touched as the
+// policy says, the others are left to the thread that uses them
+void* allocatePages(size_t bytes, bool partitioned = true);
+void freePages(void* data, size_t bytes);
+
+#endif // PAGE_ALLOCATOR_HPP
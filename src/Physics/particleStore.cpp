@@ -0,0 +1,279 @@
+#include "particleStore.hpp"
+
+#include <algorithm>
+#include <initializer_list>
+
+ParticleStore::ParticleStore(const ParticleStore& other)
+    : position(other.position), velocity(other.velocity), nextPosition(other.nextPosition),
+      nextVelocity(other.nextVelocity), predicted(other.predicted), force(other.force),
+      density(other.density), pressure(other.pressure), alive(other.alive), count(other.count),
+      attributeMap(other.attributeMap) {
+    for (const auto& column : other.attributes) attributes.push_back(column ? column->clone() : nullptr);
+}
+
+ParticleStore& ParticleStore::operator=(const ParticleStore& other) {
+    if (this != &other) *this = ParticleStore(other);
+    return *this;
+}
+
+glm::vec3 CellPositionArray::get(size_t i) const {
+    return glm::vec3(static_cast<float>(cx[i]) * cellSize + offset.x[i], static_cast<float>(cy[i]) * cellSize + offset.y[i],
+                     static_cast<float>(cz[i]) * cellSize + offset.z[i]);
+}
+
+glm::vec3 CellPositionArray::getRelative(size_t i) const {
+    return glm::vec3(static_cast<float>(cx[i] - frame[0]) * cellSize + offset.x[i],
+                     static_cast<float>(cy[i] - frame[1]) * cellSize + offset.y[i],
+                     static_cast<float>(cz[i] - frame[2]) * cellSize + offset.z[i]);
+}
+
+// splits a coordinate into cell and offset, in double so a coordinate far out keeps the
+// precision it came with
+static void encodeAxis(double w, float cellSize, int32_t& cell, float& offset) {
+    double c = std::floor(w / cellSize);
+    cell = static_cast<int32_t>(c);
+    offset = static_cast<float>(w - c * cellSize);
+    wrapCellOffset(cell, offset, cellSize);
+}
+
+void CellPositionArray::set(size_t i, const glm::vec3& p) {
+    encodeAxis(p.x, cellSize, cx[i], offset.x[i]);
+    encodeAxis(p.y, cellSize, cy[i], offset.y[i]);
+    encodeAxis(p.z, cellSize, cz[i], offset.z[i]);
+}
+
+void CellPositionArray::add(size_t i, const glm::vec3& d) {
+    offset.add(i, d);
+    wrapCellOffset(cx[i], offset.x[i], cellSize);
+    wrapCellOffset(cy[i], offset.y[i], cellSize);
+    wrapCellOffset(cz[i], offset.z[i], cellSize);
+}
+
+void CellPositionArray::decode(size_t n, float* x, float* y, float* z, bool relative) const {
+    auto axis = [&](const AlignedVector<int32_t>& cell, const AlignedVector<float>& off, int32_t base, float* out) {
+        for (size_t i = 0; i < n; ++i) out[i] = static_cast<float>(cell[i] - base) * cellSize + off[i];
+    };
+    axis(cx, offset.x, relative ? frame[0] : 0, x);
+    axis(cy, offset.y, relative ? frame[1] : 0, y);
+    axis(cz, offset.z, relative ? frame[2] : 0, z);
+}
+
+void CellPositionArray::rescale(size_t n, float newCellSize) {
+    auto axis = [&](AlignedVector<int32_t>& cell, AlignedVector<float>& off) {
+        for (size_t i = 0; i < n; ++i) encodeAxis(static_cast<double>(cell[i]) * cellSize + off[i], newCellSize, cell[i], off[i]);
+    };
+    axis(cx, offset.x);
+    axis(cy, offset.y);
+    axis(cz, offset.z);
+    cellSize = newCellSize;
+}
+
+void CellPositionArray::resize(size_t n) {
+    cx.resize(n, 0);
+    cy.resize(n, 0);
+    cz.resize(n, 0);
+    offset.resize(n);
+}
+
+void CellPositionArray::reserve(size_t n) {
+    cx.reserve(n);
+    cy.reserve(n);
+    cz.reserve(n);
+    offset.reserve(n);
+}
+
+void CellPositionArray::clear() {
+    cx.clear();
+    cy.clear();
+    cz.clear();
+    offset.clear();
+}
+
+size_t CellPositionArray::sizeBytes() const {
+    return (cx.size() + cy.size() + cz.size()) * sizeof(int32_t) + offset.sizeBytes();
+}
+
+size_t CellPositionArray::capacityBytes() const {
+    return (cx.capacity() + cy.capacity() + cz.capacity()) * sizeof(int32_t) + offset.capacityBytes();
+}
+
+void ParticleStore::reserve(size_t n) {
+    size_t padded = paddedCount(n);
+    if (padded <= alive.capacity()) return;
+    size_t slots = (padded + BLOCK - 1) / BLOCK * BLOCK;
+    for (Vec3Array* v : {&predicted, &force}) v->reserve(slots);
+    for (CellPositionArray* v : {&position, &nextPosition}) v->reserve(slots);
+    for (BasicVec3Array<StoredFloat>* v : {&velocity, &nextVelocity}) v->reserve(slots);
+    density.reserve(slots);
+    pressure.reserve(slots);
+    alive.reserve(slots);
+    for (auto& column : attributes) {
+        if (column) column->reserve(slots);
+    }
+    reallocations++;
+}
+
+void ParticleStore::reallocate() {
+    // a copy holds just the slots in use, the reserve brings it back to the capacity
+    ParticleStore fresh(*this);
+    fresh.reserve(capacity());
+    fresh.reallocations = reallocations + 1;
+    *this = std::move(fresh);
+}
+
+void ParticleStore::resize(size_t n) {
+    size_t keep = std::min(n, count), padded = paddedCount(n);
+    // past the capacity by half again, so a growing pool reallocates a logarithmic number of times
+    if (padded > alive.capacity()) reserve(std::max(padded, alive.capacity() * 3 / 2));
+    // cut back to the particles that stay first, so lanes that become padding are zeroed
+    for (Vec3Array* v : {&predicted, &force}) {
+        v->resize(keep);
+        v->resize(padded);
+    }
+    for (CellPositionArray* v : {&position, &nextPosition}) {
+        v->resize(keep);
+        v->resize(padded);
+    }
+    for (BasicVec3Array<StoredFloat>* v : {&velocity, &nextVelocity}) {
+        v->resize(keep);
+        v->resize(padded);
+    }
+    for (AlignedVector<StoredFloat>* v : {&density, &pressure}) {
+        v->resize(keep);
+        v->resize(padded, StoredFloat(0.0f));
+    }
+    alive.resize(keep);
+    alive.resize(padded, 0);
+    for (auto& column : attributes) {
+        if (column) column->resize(keep, padded);
+    }
+    count = n;
+}
+
+void ParticleStore::clear() {
+    for (Vec3Array* v : {&predicted, &force}) v->clear();
+    for (CellPositionArray* v : {&position, &nextPosition}) v->clear();
+    for (BasicVec3Array<StoredFloat>* v : {&velocity, &nextVelocity}) v->clear();
+    density.clear();
+    pressure.clear();
+    alive.clear();
+    for (auto& column : attributes) {
+        if (column) column->resize(0, 0);
+    }
+    count = 0;
+}
+
+void ParticleStore::push_back(const Particle& p) {
+    resize(count + 1);
+    set(count - 1, p);
+    alive[count - 1] = 1;
+}
+
+// every other slot may be read from, so the copy back waits for the whole gather
+template <typename T>
+static void permuteArray(AlignedVector<T>& v, const uint32_t* order, size_t count, void* scratch, ThreadPool& workers) {
+    T* tmp = static_cast<T*>(scratch);
+    workers.parallelFor(0, count, PERMUTE_GRAIN, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i) tmp[i] = v[order[i]];
+    });
+    workers.parallelFor(0, count, PERMUTE_GRAIN, [&](size_t begin, size_t end, int) {
+        std::copy(tmp + begin, tmp + end, v.begin() + begin);
+    });
+}
+
+template <typename T>
+static void permuteArray(BasicVec3Array<T>& v, const uint32_t* order, size_t count, void* scratch, ThreadPool& workers) {
+    permuteArray(v.x, order, count, scratch, workers);
+    permuteArray(v.y, order, count, scratch, workers);
+    permuteArray(v.z, order, count, scratch, workers);
+}
+
+void ParticleStore::permute(const uint32_t* order, void* scratch, ThreadPool& workers) {
+    for (Vec3Array* v : {&predicted, &force}) permuteArray(*v, order, count, scratch, workers);
+    // positions and velocities are gathered into the next generation, no copy back needed
+    workers.parallelFor(0, count, PERMUTE_GRAIN, [&](size_t begin, size_t end, int) {
+        auto gather = [&](auto& dst, const auto& src) {
+            for (size_t i = begin; i < end; ++i) dst[i] = src[order[i]];
+        };
+        gather(nextPosition.cx, position.cx);
+        gather(nextPosition.cy, position.cy);
+        gather(nextPosition.cz, position.cz);
+        gather(nextPosition.offset.x, position.offset.x);
+        gather(nextPosition.offset.y, position.offset.y);
+        gather(nextPosition.offset.z, position.offset.z);
+        gather(nextVelocity.x, velocity.x);
+        gather(nextVelocity.y, velocity.y);
+        gather(nextVelocity.z, velocity.z);
+    });
+    swapGenerations();
+    permuteArray(density, order, count, scratch, workers);
+    permuteArray(pressure, order, count, scratch, workers);
+    permuteArray(alive, order, count, scratch, workers);
+    for (auto& column : attributes) {
+        if (column) column->permute(order, count, scratch, workers);
+    }
+}
+
+void ParticleStore::swapGenerations() {
+    nextPosition.cellSize = position.cellSize;
+    std::copy(position.frame, position.frame + 3, nextPosition.frame);
+    std::swap(position, nextPosition);
+    std::swap(velocity, nextVelocity);
+}
+
+void ParticleStore::setPositionFrame(float cellSize, const int32_t frame[3]) {
+    float shift[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        shift[axis] = static_cast<float>(static_cast<double>(position.frame[axis]) * position.cellSize -
+                                         static_cast<double>(frame[axis]) * cellSize);
+    }
+    if (cellSize != position.cellSize) position.rescale(count, cellSize);
+    for (int axis = 0; axis < 3; ++axis) position.frame[axis] = frame[axis];
+    auto shiftAxis = [&](AlignedVector<float>& v, float d) {
+        for (size_t i = 0; i < count; ++i) v[i] += d;
+    };
+    shiftAxis(predicted.x, shift[0]);
+    shiftAxis(predicted.y, shift[1]);
+    shiftAxis(predicted.z, shift[2]);
+}
+
+size_t ParticleStore::permuteScratchBytes() const {
+    size_t widest = sizeof(float);
+    for (const auto& column : attributes) {
+        if (column) widest = std::max(widest, column->elementSize());
+    }
+    return count * widest;
+}
+
+void ParticleStore::removeAttribute(const std::string& name) {
+    auto it = attributeMap.find(name);
+    if (it == attributeMap.end()) return;
+    attributes[it->second].reset();
+    attributeMap.erase(it);
+}
+
+void ParticleStore::resetAttributes(size_t i) {
+    for (auto& column : attributes) {
+        if (column) column->resetSlot(i);
+    }
+}
+
+size_t ParticleStore::sizeBytes() const {
+    size_t bytes = position.sizeBytes() + velocity.sizeBytes() + nextPosition.sizeBytes() + nextVelocity.sizeBytes() +
+           predicted.sizeBytes() + force.sizeBytes() +
+           (density.size() + pressure.size()) * sizeof(StoredFloat) + alive.size();
+    for (const auto& column : attributes) {
+        if (column) bytes += column->sizeBytes();
+    }
+    return bytes;
+}
+
+size_t ParticleStore::capacityBytes() const {
+    size_t bytes = position.capacityBytes() + velocity.capacityBytes() + nextPosition.capacityBytes() +
+           nextVelocity.capacityBytes() + predicted.capacityBytes() + force.capacityBytes() +
+           (density.capacity() + pressure.capacity()) * sizeof(StoredFloat) + alive.capacity();
+    for (const auto& column : attributes) {
+        if (column) bytes += column->capacityBytes();
+    }
+    return bytes;
+}
@@ -0,0 +1,339 @@
+#ifndef PARTICLE_STORE_HPP
+#define PARTICLE_STORE_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+#include "half.hpp"
+#include "pageAllocator.hpp"
+#include "threadPool.hpp"
+
+struct Particle{
+    glm::vec3 position;
+    glm::vec3 velocity;
+};
+
+// one cache line, also the widest simd register (avx-512)
+constexpr size_t SIMD_ALIGN = 64;
+constexpr size_t SIMD_FLOATS = SIMD_ALIGN / sizeof(float);
+
+// rounds n up to a whole number of simd registers
+inline size_t paddedCount(size_t n) {
+    return (n + SIMD_FLOATS - 1) / SIMD_FLOATS * SIMD_FLOATS;
+}
+
+template <typename T, size_t Align = SIMD_ALIGN>
+struct AlignedAllocator {
+    using value_type = T;
+    template <typename U> struct rebind { using other = AlignedAllocator<U, Align>; };
+
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+
+    // big arrays are mapped directly and follow the page policy
+    T* allocate(size_t n) {
+        if (n * sizeof(T) >= LARGE_ALLOCATION) return static_cast<T*>(allocatePages(n * sizeof(T)));
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Align)));
+    }
+    void deallocate(T* p, size_t n) {
+        if (n * sizeof(T) >= LARGE_ALLOCATION) freePages(p, n * sizeof(T));
+        else ::operator delete(p, std::align_val_t(Align));
+    }
+
+    template <typename U> bool operator==(const AlignedAllocator<U, Align>&) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U, Align>&) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// velocity, density and pressure are stored as 16 bit floats when built with SPH_HALF_STORAGE.
+// positions keep full precision, a cell is too small for the steps half has far from the origin
+#ifdef SPH_HALF_STORAGE
+using StoredFloat = Half;
+#else
+using StoredFloat = float;
+#endif
+
+// x, y and z in separate arrays
+template <typename T>
+struct BasicVec3Array {
+    AlignedVector<T> x, y, z;
+
+    glm::vec3 get(size_t i) const {
+        return glm::vec3(static_cast<float>(x[i]), static_cast<float>(y[i]), static_cast<float>(z[i]));
+    }
+    void set(size_t i, const glm::vec3& v) {
+        x[i] = v.x;
+        y[i] = v.y;
+        z[i] = v.z;
+    }
+    void add(size_t i, const glm::vec3& v) {
+        x[i] += v.x;
+        y[i] += v.y;
+        z[i] += v.z;
+    }
+    void resize(size_t n) {
+        x.resize(n, T(0.0f));
+        y.resize(n, T(0.0f));
+        z.resize(n, T(0.0f));
+    }
+    void reserve(size_t n) {
+        x.reserve(n);
+        y.reserve(n);
+        z.reserve(n);
+    }
+    void clear() {
+        x.clear();
+        y.clear();
+        z.clear();
+    }
+    size_t sizeBytes() const { return (x.size() + y.size() + z.size()) * sizeof(T); }
+    size_t capacityBytes() const { return (x.capacity() + y.capacity() + z.capacity()) * sizeof(T); }
+};
+
+using Vec3Array = BasicVec3Array<float>;
+
+// moves the offset back inside [0, cellSize) and the cell by as many cells as it left by
+inline void wrapCellOffset(int32_t& cell, float& offset, float cellSize) {
+    if (offset >= 0.0f && offset < cellSize) return;
+    float steps = std::floor(offset / cellSize);
+    cell += static_cast<int32_t>(steps);
+    offset = std::clamp(offset - steps * cellSize, 0.0f, std::nextafter(cellSize, 0.0f));
+}
+
+// positions as the grid cell they are in plus the offset inside that cell,
+// world = cell * cellSize + offset. the offset is equally precise anywhere in the domain, so
+// a small step added to it is never lost to the size of the coordinate. the solver works
+// relative to the corner of the frame cell, which it keeps near the box
+struct CellPositionArray {
+    AlignedVector<int32_t> cx, cy, cz;
+    Vec3Array offset;
+    float cellSize = 1.0f;
+    int32_t frame[3] = {0, 0, 0};
+
+    // world position
+    glm::vec3 get(size_t i) const;
+    void set(size_t i, const glm::vec3& p);
+    void add(size_t i, const glm::vec3& d);
+    // position relative to the frame corner
+    glm::vec3 getRelative(size_t i) const;
+    glm::vec3 frameOrigin() const { return glm::vec3(frame[0], frame[1], frame[2]) * cellSize; }
+
+    // the first n positions into x, y and z, relative to the frame corner or in world space.
+    // one pass per axis with no branches, so it vectorizes
+    void decode(size_t n, float* x, float* y, float* z, bool relative) const;
+    // re-encodes the first n positions for cells of newCellSize
+    void rescale(size_t n, float newCellSize);
+
+    void resize(size_t n);
+    void reserve(size_t n);
+    void clear();
+    size_t sizeBytes() const;
+    size_t capacityBytes() const;
+};
+
+// particles per chunk of the threaded permute gathers
+constexpr size_t PERMUTE_GRAIN = 4096;
+
+// a per-particle column registered by name, the store resizes, permutes and compacts it
+// together with the built in arrays
+class AttributeColumn {
+public:
+    virtual ~AttributeColumn() = default;
+    virtual const std::type_info& type() const = 0;
+    virtual size_t elementSize() const = 0;
+    virtual void reserve(size_t n) = 0;
+    // keeps the first `keep` values and fills up to `padded` with the initial value
+    virtual void resize(size_t keep, size_t padded) = 0;
+    // gathers into scratch and copies back, both on workers
+    virtual void permute(const uint32_t* order, size_t count, void* scratch, ThreadPool& workers) = 0;
+    virtual void resetSlot(size_t i) = 0;
+    virtual size_t sizeBytes() const = 0;
+    virtual size_t capacityBytes() const = 0;
+    virtual std::unique_ptr<AttributeColumn> clone() const = 0;
+};
+
+template <typename T>
+class TypedAttributeColumn : public AttributeColumn {
+public:
+    AlignedVector<T> data;
+    T initial;
+
+    explicit TypedAttributeColumn(const T& initial) : initial(initial) {}
+
+    const std::type_info& type() const override { return typeid(T); }
+    size_t elementSize() const override { return sizeof(T); }
+    void reserve(size_t n) override { data.reserve(n); }
+    void resize(size_t keep, size_t padded) override {
+        data.resize(keep, initial);
+        data.resize(padded, initial);
+    }
+    void permute(const uint32_t* order, size_t count, void* scratch, ThreadPool& workers) override {
+        T* tmp = static_cast<T*>(scratch);
+        workers.parallelFor(0, count, PERMUTE_GRAIN, [&](size_t begin, size_t end, int) {
+            for (size_t i = begin; i < end; ++i) tmp[i] = data[order[i]];
+        });
+        workers.parallelFor(0, count, PERMUTE_GRAIN, [&](size_t begin, size_t end, int) {
+            std::copy(tmp + begin, tmp + end, data.begin() + begin);
+        });
+    }
+    void resetSlot(size_t i) override { data[i] = initial; }
+    size_t sizeBytes() const override { return data.size() * sizeof(T); }
+    size_t capacityBytes() const override { return data.capacity() * sizeof(T); }
+    std::unique_ptr<AttributeColumn> clone() const override {
+        return std::make_unique<TypedAttributeColumn<T>>(*this);
+    }
+};
+
+// index of a registered attribute, only valid for the store that handed it out
+template <typename T>
+struct AttributeHandle {
+    static constexpr uint32_t NONE = UINT32_MAX;
+    uint32_t index = NONE;
+    bool valid() const { return index != NONE; }
+};
+
+// structure of arrays for everything the solver keeps per particle. positions are stored per
+// cell (see CellPositionArray), predicted positions are relative to the frame. every array is 64 byte
+// aligned and padded with zeros to a multiple of SIMD_FLOATS, so loops over paddedSize()
+// need no remainder handling. the padding is never read as a particle.
+// capacity is a whole number of blocks of BLOCK particles. going past it reallocates and
+// copies every array and attribute column (to 1.5 times the capacity), so a scene that keeps
+// emitting reserve()s its peak count once and then never reallocates. slots can be dead
+// (alive[i] == 0), they keep their place until the solver reuses or compacts them.
+// anything else a scene wants per particle (temperature, age, colour...) is an attribute,
+// nothing is stored for it until addAttribute() is called.
+// positions and velocities are double buffered: a step reads position/velocity and the
+// integration writes nextPosition/nextVelocity, swapGenerations() makes those the current
+// ones. no pass writes an array it (or another pass running beside it) reads
+class ParticleStore {
+public:
+    static constexpr size_t BLOCK = 4096;
+
+    CellPositionArray position;
+    BasicVec3Array<StoredFloat> velocity;
+    // only sized and swapped, the contents are whatever the last integration left
+    CellPositionArray nextPosition;
+    BasicVec3Array<StoredFloat> nextVelocity;
+    Vec3Array predicted;
+    Vec3Array force;
+    AlignedVector<StoredFloat> density;
+    AlignedVector<StoredFloat> pressure;
+    AlignedVector<uint8_t> alive;
+
+    ParticleStore() = default;
+    // a copy gets its own copy of every attribute
+    ParticleStore(const ParticleStore& other);
+    ParticleStore& operator=(const ParticleStore& other);
+    ParticleStore(ParticleStore&&) = default;
+    ParticleStore& operator=(ParticleStore&&) = default;
+
+    size_t size() const { return count; }
+    size_t paddedSize() const { return paddedCount(count); }
+    bool empty() const { return count == 0; }
+
+    // new slots are zeroed and dead
+    void resize(size_t n);
+    // capacity for n particles, rounded up to whole blocks. never shrinks
+    void reserve(size_t n);
+    // moves every array and column to new ones of the same capacity, allocated under the
+    // page policy in force now
+    void reallocate();
+    // times the arrays were reallocated, reserve(), reallocate() and growth past the capacity
+    uint64_t reallocations = 0;
+    void clear();
+    // appends a live particle
+    void push_back(const Particle& p);
+    size_t capacity() const { return alive.capacity(); }
+
+    Particle get(size_t i) const { return {position.get(i), velocity.get(i)}; }
+    void set(size_t i, const Particle& p) {
+        position.set(i, p.position);
+        velocity.set(i, p.velocity);
+    }
+
+    // moves the position encoding to cells of cellSize and the frame to `frame`, predicted
+    // positions are shifted along so they stay valid
+    void setPositionFrame(float cellSize, const int32_t frame[3]);
+
+    // the next generation becomes the current one, it keeps the cell size and frame
+    void swapGenerations();
+
+    // slot i takes the particle that was in slot order[i], scratch holds permuteScratchBytes().
+    // the gathers run on workers
+    void permute(const uint32_t* order, void* scratch, ThreadPool& workers);
+
+    // scratch bytes permute() needs, enough for the widest column
+    size_t permuteScratchBytes() const;
+
+    // registers a column that starts at `initial` for every slot, the handle of an existing
+    // column of the same name and type is returned as is
+    template <typename T>
+    AttributeHandle<T> addAttribute(const std::string& name, const T& initial = T());
+    // invalid handle if there is no such column, throws if it holds another type
+    template <typename T>
+    AttributeHandle<T> findAttribute(const std::string& name) const;
+    void removeAttribute(const std::string& name);
+
+    template <typename T>
+    AlignedVector<T>& attribute(AttributeHandle<T> handle) {
+        return static_cast<TypedAttributeColumn<T>*>(attributes[handle.index].get())->data;
+    }
+    template <typename T>
+    const AlignedVector<T>& attribute(AttributeHandle<T> handle) const {
+        return static_cast<const TypedAttributeColumn<T>*>(attributes[handle.index].get())->data;
+    }
+    // puts every attribute of slot i back to its initial value
+    void resetAttributes(size_t i);
+
+    // bytes of the padded slots, and of the capacity behind them
+    size_t sizeBytes() const;
+    size_t capacityBytes() const;
+
+private:
+    size_t count = 0;
+    // removed columns leave a null entry so handles stay valid
+    std::vector<std::unique_ptr<AttributeColumn>> attributes;
+    std::unordered_map<std::string, uint32_t> attributeMap;
+};
+
+template <typename T>
+AttributeHandle<T> ParticleStore::addAttribute(const std::string& name, const T& initial) {
+    static_assert(std::is_trivially_copyable_v<T>, "attributes are moved around with plain copies");
+    AttributeHandle<T> handle = findAttribute<T>(name);
+    if (handle.valid()) return handle;
+    auto column = std::make_unique<TypedAttributeColumn<T>>(initial);
+    column->reserve(alive.capacity());
+    column->resize(count, paddedSize());
+    handle.index = static_cast<uint32_t>(attributes.size());
+    attributes.push_back(std::move(column));
+    attributeMap[name] = handle.index;
+    return handle;
+}
+
+template <typename T>
+AttributeHandle<T> ParticleStore::findAttribute(const std::string& name) const {
+    AttributeHandle<T> handle;
+    auto it = attributeMap.find(name);
+    if (it == attributeMap.end()) return handle;
+    if (attributes[it->second]->type() != typeid(T)) {
+        throw std::runtime_error("Particle attribute '" + name + "' holds another type.");
+    }
+    handle.index = it->second;
+    return handle;
+}
+
+#endif // PARTICLE_STORE_HPP
@@ -0,0 +1,74 @@
+#include "scratchArena.hpp"
+#include "pageAllocator.hpp"
+
+#include <algorithm>
+#include <new>
+#include <utility>
+
+ScratchArena::ScratchArena(ScratchArena&& other) noexcept
+    : blocks(std::move(other.blocks)), current(other.current), offset(other.offset), used(other.used), peak(other.peak) {
+    other.blocks.clear();
+    other.current = other.offset = other.used = 0;
+}
+
+ScratchArena::~ScratchArena() {
+    release();
+}
+
+// big blocks get huge pages like the particle arrays, but no partitioned first touch: an
+// arena belongs to one worker, which is the first to write to it
+static std::byte* allocateBlock(size_t size) {
+    if (size >= LARGE_ALLOCATION) return static_cast<std::byte*>(allocatePages(size, false));
+    return static_cast<std::byte*>(::operator new(size, std::align_val_t(ScratchArena::ALIGN)));
+}
+
+void ScratchArena::release() {
+    for (const Block& block : blocks) {
+        if (block.size >= LARGE_ALLOCATION) freePages(block.data, block.size);
+        else ::operator delete(block.data, std::align_val_t(ALIGN));
+    }
+    blocks.clear();
+}
+
+void* ScratchArena::allocateBytes(size_t bytes) {
+    bytes = (bytes + ALIGN - 1) / ALIGN * ALIGN;
+    // the current block, then any later block that is big enough, then a new one
+    while (current < blocks.size() && offset + bytes > blocks[current].size) {
+        current++;
+        offset = 0;
+    }
+    if (current == blocks.size()) {
+        size_t last = blocks.empty() ? 0 : blocks.back().size;
+        size_t size = std::max({bytes, 2 * last, size_t(64) << 10});
+        blocks.push_back({allocateBlock(size), size});
+        offset = 0;
+    }
+    void* data = blocks[current].data + offset;
+    offset += bytes;
+    used += bytes;
+    peak = std::max(peak, used);
+    return data;
+}
+
+void ScratchArena::rewind(const Marker& marker) {
+    current = marker.block;
+    offset = marker.offset;
+    used = marker.used;
+}
+
+void ScratchArena::reset() {
+    current = 0;
+    offset = 0;
+    used = 0;
+    if (blocks.size() <= 1) return;
+    // a step that spilled into several blocks gets one block that holds all of it
+    size_t size = (peak + peak / 8 + ALIGN - 1) / ALIGN * ALIGN;
+    release();
+    blocks.push_back({allocateBlock(size), size});
+}
+
+size_t ScratchArena::capacity() const {
+    size_t total = 0;
+    for (const Block& block : blocks) total += block.size;
+    return total;
+}
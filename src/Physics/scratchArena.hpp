@@ -0,0 +1,75 @@
+#ifndef SCRATCH_ARENA_HPP
+#define SCRATCH_ARENA_HPP
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// bump allocator for buffers that only live during one step. allocations are never freed
+// one by one, a ScratchScope gives back everything allocated while it was alive and reset()
+// gives back everything. when a step needed more than one block they are merged on reset,
+// so after the first few steps one block holds the whole step and nothing touches the heap
+class ScratchArena {
+public:
+    struct Marker {
+        size_t block;
+        size_t offset;
+        size_t used;
+    };
+
+    ScratchArena() = default;
+    // a copy starts empty, blocks are never shared
+    ScratchArena(const ScratchArena&) {}
+    ScratchArena& operator=(const ScratchArena&) { return *this; }
+    ScratchArena(ScratchArena&& other) noexcept;
+    ~ScratchArena();
+
+    // n default constructed Ts, 64 byte aligned. only for types that need no destructor
+    template <typename T>
+    T* allocate(size_t n) {
+        static_assert(std::is_trivially_destructible_v<T>, "arena memory is never destroyed");
+        T* data = static_cast<T*>(allocateBytes(n * sizeof(T)));
+        std::uninitialized_default_construct_n(data, n);
+        return data;
+    }
+
+    Marker mark() const { return {current, offset, used}; }
+    void rewind(const Marker& marker);
+    // rewinds to the start, must only be called when nothing allocated here is in use
+    void reset();
+
+    size_t highWater() const { return peak; }
+    size_t capacity() const;
+
+    static constexpr size_t ALIGN = 64;
+
+private:
+    struct Block {
+        std::byte* data;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    size_t current = 0;
+    size_t offset = 0;
+    size_t used = 0;
+    size_t peak = 0;
+
+    void* allocateBytes(size_t bytes);
+    void release();
+};
+
+// rewinds the arena to where it was when the scope was opened
+class ScratchScope {
+public:
+    explicit ScratchScope(ScratchArena& arena) : arena(arena), marker(arena.mark()) {}
+    ~ScratchScope() { arena.rewind(marker); }
+    ScratchScope(const ScratchScope&) = delete;
+    ScratchScope& operator=(const ScratchScope&) = delete;
+
+private:
+    ScratchArena& arena;
+    ScratchArena::Marker marker;
+};
+
+#endif // SCRATCH_ARENA_HPP
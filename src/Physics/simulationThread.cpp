@@ -0,0 +1,225 @@
+#include "simulationThread.hpp"
+
+#include <chrono>
+#include <stdexcept>
+
+void SolverSettings::read(const SPHSolver& solver) {
+    compactionThreshold = solver.compactionThreshold;
+    restDensity = solver.restDensity;
+    gravity_m = solver.gravity_m;
+    h = solver.h;
+    pressure_multiplier = solver.pressure_multiplier;
+    viscosity = solver.viscosity;
+    max_speed = solver.max_speed;
+    reorderInterval = solver.reorderInterval;
+    neighbourSearch = solver.neighbourSearch;
+    cellsPerH = solver.cellsPerH;
+    useSymmetricPairs = solver.useSymmetricPairs;
+    numThreads = solver.numThreads;
+    useWorkStealing = solver.useWorkStealing;
+    useTiles = solver.useTiles;
+    tileCells = solver.tileCells;
+    usePairCache = solver.usePairCache;
+    pairCacheBudget = solver.pairCacheBudget;
+    useVerletLists = solver.useVerletLists;
+    verletSkin = solver.verletSkin;
+    compressVerletLists = solver.compressVerletLists;
+    hugePages = getPagePolicy().hugePages;
+    numaFirstTouch = solver.getNumaFirstTouch();
+}
+
+void SolverSettings::apply(SPHSolver& solver) const {
+    solver.compactionThreshold = compactionThreshold;
+    solver.restDensity = restDensity;
+    solver.gravity_m = gravity_m;
+    solver.h = h;
+    solver.pressure_multiplier = pressure_multiplier;
+    solver.viscosity = viscosity;
+    solver.max_speed = max_speed;
+    solver.reorderInterval = reorderInterval;
+    solver.neighbourSearch = neighbourSearch;
+    solver.cellsPerH = cellsPerH;
+    solver.useSymmetricPairs = useSymmetricPairs;
+    solver.numThreads = numThreads;
+    solver.useWorkStealing = useWorkStealing;
+    solver.useTiles = useTiles;
+    solver.tileCells = tileCells;
+    solver.usePairCache = usePairCache;
+    solver.pairCacheBudget = pairCacheBudget;
+    solver.useVerletLists = useVerletLists;
+    solver.verletSkin = verletSkin;
+    solver.compressVerletLists = compressVerletLists;
+    // moves the particle arrays, only when it changed
+    if (getPagePolicy().hugePages != hugePages || solver.getNumaFirstTouch() != numaFirstTouch) solver.setPagePolicy(hugePages, numaFirstTouch);
+}
+
+void SolverStats::read(SPHSolver& solver) {
+    liveCount = solver.getLiveCount();
+    slots = solver.particles.size();
+    fragmentation = solver.getFragmentation();
+    compactionCount = solver.compactionCount;
+    reorderCount = solver.reorderCount;
+    particleBytes = solver.particles.capacityBytes();
+    averageDensity = liveCount ? solver.getAverageDensity() : 0.0f;
+    mass = solver.mass;
+    searchMemory = solver.getSearchMemory();
+    cellCount = solver.getCellCount();
+    scratchHighWater = solver.getScratchHighWater();
+    scratchCapacity = solver.getScratchCapacity();
+    stencilCells = solver.stencil->cellCount;
+    gridStats = solver.gridStats;
+    workers = solver.getWorkerStats();
+    tileStats = solver.tileStats;
+    pairCacheStats = solver.pairCacheStats;
+    verletStats = solver.verletStats;
+    pageStats = getPageStats();
+    solver.getMemoryReport(memory);
+}
+
+SimulationThread::SimulationThread(SPHSolver& solver, float dt) : solver(solver), dt(dt) {}
+
+SimulationThread::~SimulationThread() {
+    stop();
+}
+
+void SimulationThread::start() {
+    if (thread.joinable()) throw std::runtime_error("SimulationThread::start: already running");
+    stopping = false;
+    publishSnapshot();
+    snapshots.acquire();
+    thread = std::thread(&SimulationThread::loop, this);
+}
+
+void SimulationThread::stop() {
+    if (!thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(controlMutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+void SimulationThread::setPaused(bool pause) {
+    {
+        std::lock_guard<std::mutex> lock(controlMutex);
+        if (paused == pause) return;
+        paused = pause;
+    }
+    if (pause) stepsPerSecond = 0.0f;
+    wake.notify_one();
+}
+
+void SimulationThread::setBox(const glm::vec3& pos, const glm::vec3& size) {
+    std::lock_guard<std::mutex> lock(controlMutex);
+    boxPos = pos;
+    boxSize = size;
+    boxChanged = true;
+}
+
+void SimulationThread::setRadius(float r) {
+    std::lock_guard<std::mutex> lock(controlMutex);
+    radius = r;
+    radiusChanged = true;
+}
+
+void SimulationThread::setSettings(const SolverSettings& newSettings) {
+    std::lock_guard<std::mutex> lock(controlMutex);
+    settings = newSettings;
+    settingsChanged = true;
+}
+
+void SimulationThread::post(SolverCommand command) {
+    std::lock_guard<std::mutex> lock(controlMutex);
+    commands.push_back(command);
+}
+
+SolverSettings SimulationThread::getSettings() const {
+    std::lock_guard<std::mutex> lock(controlMutex);
+    // edits in flight would snap back for the frames until the snapshot has them
+    if (settingsChanged || snapshot().step < settingsStep) return settings;
+    return snapshot().settings;
+}
+
+bool SimulationThread::waitUntilRunning() {
+    std::unique_lock<std::mutex> lock(controlMutex);
+    wake.wait(lock, [&] { return stopping || !paused; });
+    return !stopping;
+}
+
+void SimulationThread::takeInputs() {
+    bool newSettings = false;
+    {
+        std::lock_guard<std::mutex> lock(controlMutex);
+        if (boxChanged) {
+            solver.boxPos = boxPos;
+            solver.boxSize = boxSize;
+            boxChanged = false;
+        }
+        if (radiusChanged) {
+            solver.radius = radius;
+            radiusChanged = false;
+        }
+        if (settingsChanged) {
+            takenSettings = settings;
+            settingsChanged = false;
+            settingsStep = stepCount + 1;
+            newSettings = true;
+        }
+        takenCommands.swap(commands);
+    }
+    // a page policy change or a calibration takes a while, the UI does not wait for it
+    if (newSettings) takenSettings.apply(solver);
+    for (SolverCommand command : takenCommands) run(command);
+    takenCommands.clear();
+}
+
+void SimulationThread::run(SolverCommand command) {
+    switch (command) {
+    case SolverCommand::SpawnParticles: solver.spawnParticles(); break;
+    case SolverCommand::SpawnRandom: solver.spawnRandom(); break;
+    case SolverCommand::RemoveRandom: solver.removeRandom(); break;
+    case SolverCommand::Clear: solver.reset(); break;
+    case SolverCommand::Stop: solver.stop(); break;
+    case SolverCommand::Calibrate: solver.calibrateCellResolution(dt); break;
+    }
+}
+
+void SimulationThread::publishSnapshot() {
+    ParticleSnapshot& next = snapshots.back();
+    solver.fillParticleView(next.particles);
+    next.settings.read(solver);
+    // a copy into storage the snapshot already has, the read only when the UI asked
+    if (statsRequested.exchange(false)) stats.read(solver);
+    next.stats = stats;
+    next.step = stepCount;
+    snapshots.publish();
+}
+
+void SimulationThread::loop() {
+    using Clock = std::chrono::steady_clock;
+    auto rateStart = Clock::now();
+    uint64_t rateSteps = 0;
+    double rateBusyMs = 0.0;
+    while (waitUntilRunning()) {
+        auto stepStart = Clock::now();
+        takeInputs();
+        solver.update(dt);
+        stepCount++;
+        publishSnapshot();
+        auto stepEnd = Clock::now();
+        rateSteps++;
+        rateBusyMs += std::chrono::duration<double, std::milli>(stepEnd - stepStart).count();
+        double elapsed = std::chrono::duration<double>(stepEnd - rateStart).count();
+        if (elapsed >= 0.5) {
+            stepsPerSecond = static_cast<float>(rateSteps / elapsed);
+            stepMs = static_cast<float>(rateBusyMs / rateSteps);
+            rateStart = stepEnd;
+            rateSteps = 0;
+            rateBusyMs = 0.0;
+        }
+
+        int maxSteps = maxStepsPerSecond;
+        if (maxSteps > 0) std::this_thread::sleep_until(stepStart + std::chrono::microseconds(1000000 / maxSteps));
+    }
+}
@@ -0,0 +1,181 @@
+#ifndef SIMULATION_THREAD_HPP
+#define SIMULATION_THREAD_HPP
+
+#include "memoryReport.hpp"
+#include "pageAllocator.hpp"
+#include "sph.hpp"
+#include "tripleBuffer.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// the solver settings the UI edits, named as in SPHSolver
+struct SolverSettings {
+    float compactionThreshold = 0.0f;
+    float restDensity = 0.0f;
+    float gravity_m = 0.0f;
+    float h = 0.0f;
+    float pressure_multiplier = 0.0f;
+    float viscosity = 0.0f;
+    float max_speed = 0.0f;
+    int reorderInterval = 0;
+    NeighbourSearch neighbourSearch = NeighbourSearch::DenseGrid;
+    int cellsPerH = 1;
+    bool useSymmetricPairs = false;
+    int numThreads = 1;
+    bool useWorkStealing = false;
+    bool useTiles = false;
+    int tileCells = 0;
+    bool usePairCache = false;
+    size_t pairCacheBudget = 0;
+    bool useVerletLists = false;
+    float verletSkin = 0.0f;
+    bool compressVerletLists = false;
+    // the page policy, setPagePolicy() when it differs
+    HugePages hugePages = HugePages::Default;
+    bool numaFirstTouch = false;
+
+    void read(const SPHSolver& solver);
+    void apply(SPHSolver& solver) const;
+};
+
+// what the solver reports after a step. reading it walks the particles and the solver's
+// arrays, so a SimulationThread only does it when asked (see requestStats)
+struct SolverStats {
+    size_t liveCount = 0;
+    size_t slots = 0;
+    float fragmentation = 0.0f;
+    uint64_t compactionCount = 0;
+    uint64_t reorderCount = 0;
+    size_t particleBytes = 0;
+    float averageDensity = 0.0f;
+    float mass = 0.0f;
+    size_t searchMemory = 0;
+    size_t cellCount = 0;
+    size_t scratchHighWater = 0;
+    size_t scratchCapacity = 0;
+    int stencilCells = 0;
+    GridStats gridStats;
+    std::vector<WorkerStats> workers;
+    TileStats tileStats;
+    PairCacheStats pairCacheStats;
+    VerletStats verletStats;
+    PageStats pageStats;
+    MemoryReport memory;
+
+    void read(SPHSolver& solver);
+};
+
+// the particles, settings and stats after one step, not changed once published
+struct ParticleSnapshot {
+    std::vector<Particle> particles;
+    SolverSettings settings;
+    SolverStats stats;
+    uint64_t step = 0;
+};
+
+// what the UI can ask the solver to do between two steps
+enum class SolverCommand {
+    SpawnParticles,
+    SpawnRandom,
+    RemoveRandom,
+    Clear,
+    Stop,
+    Calibrate,
+};
+
+// steps the solver on a thread of its own at whatever rate it manages and publishes a
+// snapshot of the particles after every step through a triple buffer. the renderer takes the
+// latest one without waiting, however long the step in flight takes. settings and commands
+// are handed over the same way in the other direction, picked up before the next step.
+// the solver must not be touched from outside while the thread runs
+class SimulationThread {
+public:
+    explicit SimulationThread(SPHSolver& solver, float dt = 0.001f);
+    ~SimulationThread();
+    SimulationThread(const SimulationThread&) = delete;
+    SimulationThread& operator=(const SimulationThread&) = delete;
+
+    // makes snapshot() the solver as it is, then starts stepping it. on the thread that takes
+    // the snapshots
+    void start();
+    void stop();
+    // a paused thread finishes its step and waits, snapshots stay where they were
+    void setPaused(bool paused);
+    // at most this many steps per second, 0 for as many as it manages
+    void setMaxStepsPerSecond(int steps) { maxStepsPerSecond = steps; }
+    int getMaxStepsPerSecond() const { return maxStepsPerSecond; }
+
+    // box and particle radius the next step runs with, never waits for the step in flight
+    void setBox(const glm::vec3& pos, const glm::vec3& size);
+    void setRadius(float radius);
+    // settings the next step runs with and commands run before it, in the order they came
+    void setSettings(const SolverSettings& settings);
+    void post(SolverCommand command);
+
+    // swaps in the latest published snapshot if there is a newer one, true if it did. never
+    // waits, snapshot() stays the same until the next call
+    bool acquireSnapshot() { return snapshots.acquire(); }
+    const ParticleSnapshot& snapshot() const { return snapshots.front(); }
+    // the settings of snapshot(), or the last ones set until a snapshot has them. on the
+    // thread that takes the snapshots
+    SolverSettings getSettings() const;
+    // the next snapshot gets stats read after its step, the ones in between repeat the last
+    // read. the UI asks every frame it shows them
+    void requestStats() { statsRequested = true; }
+
+    // over the last half second or so
+    float getStepsPerSecond() const { return stepsPerSecond; }
+    float getStepMs() const { return stepMs; }
+    uint64_t getStepCount() const { return stepCount; }
+
+private:
+    SPHSolver& solver;
+    float dt;
+    std::thread thread;
+
+    // inputs for the next step, pause and stop, only held for a moment
+    mutable std::mutex controlMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    bool paused = false;
+    bool boxChanged = false;
+    bool radiusChanged = false;
+    bool settingsChanged = false;
+    glm::vec3 boxPos = glm::vec3(0.0f);
+    glm::vec3 boxSize = glm::vec3(1.0f);
+    float radius = 0.0f;
+    SolverSettings settings;
+    // the step the last settings went into
+    uint64_t settingsStep = 0;
+    std::vector<SolverCommand> commands;
+
+    // what takeInputs() took, run outside controlMutex
+    SolverSettings takenSettings;
+    std::vector<SolverCommand> takenCommands;
+
+    TripleBuffer<ParticleSnapshot> snapshots;
+    // the stats read last, on the simulation thread
+    SolverStats stats;
+    std::atomic<bool> statsRequested{true};
+
+    std::atomic<int> maxStepsPerSecond{0};
+    std::atomic<float> stepsPerSecond{0.0f};
+    std::atomic<float> stepMs{0.0f};
+    std::atomic<uint64_t> stepCount{0};
+
+    void loop();
+    // waits while paused, false once the thread should stop
+    bool waitUntilRunning();
+    // hands the inputs set since the last step to the solver
+    void takeInputs();
+    void run(SolverCommand command);
+    // fills back() from the solver and publishes it
+    void publishSnapshot();
+};
+
+#endif // SIMULATION_THREAD_HPP
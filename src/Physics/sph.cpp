@@ -1,69 +1,1175 @@
 #include "sph.hpp"
 
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <random>
+#include <thread>
+
+// particles per parallelFor chunk, enough that taking a chunk costs nothing next to it
+static constexpr size_t PARTICLE_GRAIN = 1024;
+// scratch the threaded grid sort may take for its histograms, a row of every cell per thread.
+// a grid of many more cells than particles runs on fewer threads rather than past it
+static constexpr size_t SORT_HISTOGRAM_BYTES = 16u << 20;
 
 void SPHSolver::update(float dt) {
+    // slices follow the pool size, the pages have to follow them
+    if (numaFirstTouch && pool().size() != touchedThreads) setPagePolicy(getPagePolicy().hugePages, true);
+    resetScratch();
+    pool().resetWorkerStats();
+    if (needsReorder()) reorderParticles();
+    else if (getFragmentation() > compactionThreshold) compactParticles();
     predictePositions(dt);
-    builGrid();
+    cellsPerH = std::clamp(cellsPerH, 1, MAX_CELLS_PER_H);
+    if (!useVerletLists || useSymmetricPairs || usesTiles()) {
+        cellSize = h / cellsPerH;
+        builGrid();
+    } else if (verletNeedsRebuild()) {
+        cellSize = (h + verletSkin) / cellsPerH;
+        builGrid();
+        buildVerletLists();
+    }
     computeDensityPressure();
     computeForces();
     integrate(dt);
+    applyNudges();
+}
+
+// spreads the low 21 bits of v so there are two zero bits between each of them
+static uint64_t expandBits(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8) & 0x100f00f00f00f00full;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2) & 0x1249249249249249ull;
+    return v;
+}
+
+static uint64_t mortonCode(uint32_t x, uint32_t y, uint32_t z) {
+    return expandBits(x) | (expandBits(y) << 1) | (expandBits(z) << 2);
+}
+
+
+bool SPHSolver::needsReorder() const {
+    if (reorderInterval < 0 || particles.empty()) return false;
+    if (reorderPending) return true;
+    if (reorderInterval > 0) return stepsSinceReorder >= static_cast<uint32_t>(reorderInterval);
+    // once the fastest particle could have crossed a cell the order is getting stale
+    return reorderTravel >= cellSize;
+}
+
+void SPHSolver::reorderParticles() {
+    ScratchArena& arena = scratchArenas[0];
+    ScratchScope scope(arena);
+    size_t n = particles.size();
+    // the keys come straight from the position cells, so those have to be grid cells
+    updatePositionFrame();
+    const CellPositionArray& pos = particles.position;
+    // biased so spray far outside still sorts
+    auto biased = [](int32_t c) {
+        return static_cast<uint32_t>(std::clamp<int64_t>(int64_t(c) + (1 << 20), 0, (1 << 21) - 1));
+    };
+    auto* keys = arena.allocate<std::pair<uint64_t, uint32_t>>(n);
+    ThreadPool& workers = pool();
+    workers.parallelFor(0, n, PARTICLE_GRAIN, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t x = biased(pos.cx[i]);
+            uint32_t y = biased(pos.cy[i]);
+            uint32_t z = biased(pos.cz[i]);
+            // dead slots sort to the end and are dropped, so a reorder also compacts
+            uint64_t code = particles.alive[i] ? mortonCode(x, y, z) : ~0ull;
+            keys[i] = {code, static_cast<uint32_t>(i)};
+        }
+    });
+    std::sort(keys, keys + n);
+    uint32_t* order = arena.allocate<uint32_t>(n);
+    workers.parallelFor(0, n, PARTICLE_GRAIN, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i) order[i] = keys[i].second;
+    });
+    permuteParticles(order, getLiveCount());
+
+    stepsSinceReorder = 0;
+    reorderTravel = 0.0f;
+    reorderPending = false;
+    reorderCount++;
+}
+
+void SPHSolver::compactParticles() {
+    ScratchArena& arena = scratchArenas[0];
+    ScratchScope scope(arena);
+    size_t n = particles.size();
+    // live particles keep their relative order
+    uint32_t* order = arena.allocate<uint32_t>(n);
+    size_t live = 0, dead = getLiveCount();
+    for (size_t i = 0; i < n; ++i) {
+        if (particles.alive[i]) order[live++] = static_cast<uint32_t>(i);
+        else order[dead++] = static_cast<uint32_t>(i);
+    }
+    permuteParticles(order, live);
+    compactionCount++;
+}
+
+void SPHSolver::permuteParticles(const uint32_t* order, size_t keep) {
+    ScratchArena& arena = scratchArenas[0];
+    ScratchScope scope(arena);
+    size_t n = particles.size();
+    ThreadPool& workers = pool();
+    particles.permute(order, arena.allocate<std::byte>(particles.permuteScratchBytes()), workers);
+    uint32_t* ids = arena.allocate<uint32_t>(n);
+    workers.parallelFor(0, n, PARTICLE_GRAIN, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i) ids[i] = particleIds[order[i]];
+    });
+    std::copy(ids, ids + n, particleIds.begin());
+
+    particles.resize(keep);
+    particleIds.resize(keep);
+    for (size_t i = 0; i < keep; ++i) particleSlots[particleIds[i]] = static_cast<uint32_t>(i);
+    // every dead slot was dropped
+    if (keep < n) freeSlots.clear();
+
+    // neighbour lists and grid buckets hold slot indices, they have to be rebuilt
+    invalidateNeighbours();
+}
+
+void SPHSolver::invalidateNeighbours() {
+    verletBuildH = 0.0f;
+    gridComparable = false;
+}
+
+void SPHSolver::reserveParticles(size_t n) {
+    particles.reserve(n);
+    particleIds.reserve(n);
+    particleSlots.reserve(n);
+    freeSlots.reserve(n);
+    freeIds.reserve(n);
+}
+
+uint32_t SPHSolver::addParticle(const Particle& p) {
+    uint32_t slot;
+    if (!freeSlots.empty()) {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    } else {
+        slot = static_cast<uint32_t>(particles.size());
+        particles.resize(slot + 1);
+        particleIds.push_back(NO_ID);
+    }
+    uint32_t id;
+    if (!freeIds.empty()) {
+        id = freeIds.back();
+        freeIds.pop_back();
+    } else {
+        id = static_cast<uint32_t>(particleSlots.size());
+        particleSlots.push_back(NO_SLOT);
+    }
+    particles.set(slot, p);
+    particles.predicted.set(slot, particles.position.getRelative(slot));
+    particles.force.set(slot, glm::vec3(0.0f));
+    particles.density[slot] = restDensity;
+    particles.pressure[slot] = 0.0f;
+    particles.alive[slot] = 1;
+    particles.resetAttributes(slot);
+    particleIds[slot] = id;
+    particleSlots[id] = slot;
+    invalidateNeighbours();
+    return id;
+}
+
+void SPHSolver::removeParticle(uint32_t id) {
+    if (!isAlive(id)) return;
+    uint32_t slot = particleSlots[id];
+    // a dead slot stays where it is and never moves, it is in no cell and no list
+    particles.alive[slot] = 0;
+    particles.velocity.set(slot, glm::vec3(0.0f));
+    particles.force.set(slot, glm::vec3(0.0f));
+    particleIds[slot] = NO_ID;
+    particleSlots[id] = NO_SLOT;
+    freeSlots.push_back(slot);
+    freeIds.push_back(id);
+    invalidateNeighbours();
 }
 
 void SPHSolver::predictePositions(float dt) {
-    for (size_t i = 0; i < particles.size(); ++i) {
-        predictedPositions[i] = particles[i].position + dt * particles[i].velocity;
+    // positions are decoded relative to the frame on the way, the kernels only ever see small
+    // numbers. the loops run over whole registers, padding lanes decode to nothing that is read
+    // chunks are whole registers too
+    size_t registers = particles.paddedSize() / SIMD_FLOATS;
+    const CellPositionArray& pos = particles.position;
+    predictDt = dt;
+    forEachParticleRange(registers, SIMD_FLOATS, [&](size_t first, size_t last, int) {
+        size_t begin = first * SIMD_FLOATS, end = last * SIMD_FLOATS;
+        auto advance = [&](const AlignedVector<int32_t>& cell, const AlignedVector<float>& offset, int32_t frame,
+                           const AlignedVector<StoredFloat>& vel, AlignedVector<float>& out) {
+            for (size_t i = begin; i < end; ++i) out[i] = static_cast<float>(cell[i] - frame) * pos.cellSize + offset[i] + dt * vel[i];
+        };
+        advance(pos.cx, pos.offset.x, pos.frame[0], particles.velocity.x, particles.predicted.x);
+        advance(pos.cy, pos.offset.y, pos.frame[1], particles.velocity.y, particles.predicted.y);
+        advance(pos.cz, pos.offset.z, pos.frame[2], particles.velocity.z, particles.predicted.z);
+    });
+}
+
+void SPHSolver::updatePositionFrame() {
+    // positions are encoded in grid cells so cell coordinates come without a division, and
+    // the frame follows the box
+    const CellPositionArray& pos = particles.position;
+    int32_t frame[3];
+    bool drifted = false;
+    for (int axis = 0; axis < 3; ++axis) {
+        frame[axis] = static_cast<int32_t>(std::floor(boxPos[axis] / cellSize));
+        drifted |= std::abs(frame[axis] - pos.frame[axis]) > FRAME_DRIFT_CELLS;
     }
+    if (pos.cellSize == cellSize && !drifted) return;
+    particles.setPositionFrame(cellSize, frame);
+    invalidateNeighbours();
 }
 
 void SPHSolver::builGrid() {
-    grid.clear();
-    for (size_t i = 0; i < particles.size(); ++i) {
-        GridCoord cell = getCellCord(predictedPositions[i]);
-        grid[cell].push_back(i);
+    // cellSize has to be the search radius divided by cellsPerH for the stencil to cover it
+    stencil = &gridStencil(cellsPerH);
+    updatePositionFrame();
+    if (neighbourSearch == NeighbourSearch::CompactHash) buildHashGrid();
+    else buildDenseGrid();
+}
+
+// first of count items in slice t of threads equal slices
+static size_t slice(size_t count, int t, int threads) {
+    return count * t / threads;
+}
+
+// threads for a pass over slices of n particles, small counts are not worth waking the workers for
+static int sliceThreads(int poolSize, size_t n) {
+    return static_cast<int>(std::min<size_t>(poolSize, std::max<size_t>(n / PARTICLE_GRAIN, 1)));
+}
+
+// fn(t) for every t < threads, inline when there is only one
+template <typename F>
+static void runSlices(ThreadPool& workers, int threads, F&& fn) {
+    if (threads == 1) {
+        fn(0);
+        return;
+    }
+    workers.run([&](int t) {
+        if (t < threads) fn(t);
+    });
+}
+
+template <typename F>
+void SPHSolver::forEachParticleRange(size_t n, size_t unit, F&& fn) {
+    ThreadPool& workers = pool();
+    if (!numaFirstTouch) {
+        workers.parallelFor(0, n, PARTICLE_GRAIN / unit, fn);
+        return;
+    }
+    // worker t keeps to slice t of the capacity, the pages it touched first
+    size_t items = particles.capacity() / unit;
+    int threads = workers.size();
+    workers.run([&](int t) {
+        size_t begin = std::min(slice(items, t, threads), n);
+        size_t end = t + 1 == threads ? n : std::min(slice(items, t + 1, threads), n);
+        if (begin < end) fn(begin, end, t);
+    });
+}
+
+void SPHSolver::buildDenseGrid() {
+    // the box can be moved and resized from the UI so the grid is resized every step,
+    // resize() keeps the capacity so this does not allocate once it has grown
+    GridCoord prevOrigin = gridOrigin;
+    GridCoord prevDims = gridDims;
+    // lined up with the position cells, one cell of margin around the box
+    glm::vec3 lo = glm::floor((boxPos - boxSize * 0.5f) / cellSize) - glm::vec3(1.0f);
+    glm::vec3 hi = glm::floor((boxPos + boxSize * 0.5f) / cellSize) + glm::vec3(1.0f);
+    gridOrigin = {static_cast<int>(lo.x), static_cast<int>(lo.y), static_cast<int>(lo.z)};
+    gridDims.x = std::max(1, static_cast<int>(hi.x - lo.x) + 1);
+    gridDims.y = std::max(1, static_cast<int>(hi.y - lo.y) + 1);
+    gridDims.z = std::max(1, static_cast<int>(hi.z - lo.z) + 1);
+    size_t numCells = static_cast<size_t>(gridDims.x) * gridDims.y * gridDims.z;
+    size_t n = particles.size();
+
+    bool sameLayout = gridComparable && gridOrigin == prevOrigin && gridDims == prevDims &&
+                      cellSize == gridBuildCellSize && particleCell.size() == n && cellCount.size() == numCells;
+    gridComparable = true;
+    gridBuildCellSize = cellSize;
+
+    ScratchArena& arena = scratchArenas[0];
+    ScratchScope scope(arena);
+    uint32_t* newCells = arena.allocate<uint32_t>(n);
+    forEachParticleRange(n, 1, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i) newCells[i] = particles.alive[i] ? getCellIndex(getCellCord(i)) : NO_CELL;
+    });
+
+    if (sameLayout) {
+        // a count per slice of particles, summed once every thread is done
+        int threads = sliceThreads(pool().size(), n);
+        size_t* sliceChanged = arena.allocate<size_t>(threads);
+        runSlices(pool(), threads, [&](int t) {
+            size_t count = 0;
+            for (size_t i = slice(n, t, threads), end = slice(n, t + 1, threads); i < end; ++i) {
+                count += newCells[i] != particleCell[i];
+            }
+            sliceChanged[t] = count;
+        });
+        size_t changed = std::accumulate(sliceChanged, sliceChanged + threads, size_t(0));
+        gridStats.changedFraction = n ? static_cast<float>(changed) / n : 0.0f;
+    } else {
+        gridStats.changedFraction = 1.0f;
+    }
+    gridStats.builds++;
+
+    cellStart.resize(numCells);
+    sortedIndices.resize(getLiveCount());
+    sortDenseCells(newCells, numCells);
+}
+
+void SPHSolver::sortDenseCells(const uint32_t* newCells, size_t numCells) {
+    size_t n = particles.size();
+    // a slice of particles per thread, and no more threads than histogram rows fit the budget
+    size_t rowBytes = std::max<size_t>(numCells, 1) * sizeof(uint32_t);
+    int threads = std::min(sliceThreads(pool().size(), n), static_cast<int>(std::max<size_t>(SORT_HISTOGRAM_BYTES / rowBytes, 1)));
+    if (threads == 1) {
+        cellCount.assign(numCells, 0);
+        particleCell.assign(newCells, newCells + n);
+        // counting sort: count, prefix sum, scatter. dead slots are in no cell
+        for (size_t i = 0; i < n; ++i) {
+            if (particleCell[i] != NO_CELL) cellCount[particleCell[i]]++;
+        }
+        uint32_t sum = 0;
+        for (size_t c = 0; c < numCells; ++c) {
+            sum += cellCount[c];
+            cellStart[c] = sum;
+        }
+        // walking backwards keeps particles in index order inside each cell
+        for (size_t i = n; i-- > 0;) {
+            if (particleCell[i] != NO_CELL) sortedIndices[--cellStart[particleCell[i]]] = static_cast<uint32_t>(i);
+        }
+        return;
+    }
+
+    // the same counting sort with a histogram row per thread. thread t counts and later
+    // scatters the t-th slice, and within a cell its particles go after those of the slices
+    // before it, so the order is the serial one whatever the thread count
+    cellCount.resize(numCells);
+    particleCell.resize(n);
+    ScratchArena& arena = scratchArenas[0];
+    ScratchScope scope(arena);
+    uint32_t* histogram = arena.allocate<uint32_t>(static_cast<size_t>(threads) * numCells);
+    uint32_t* blockSums = arena.allocate<uint32_t>(threads);
+
+    runSlices(pool(), threads, [&](int t) {
+        uint32_t* counts = histogram + t * numCells;
+        std::fill(counts, counts + numCells, 0u);
+        for (size_t i = slice(n, t, threads), end = slice(n, t + 1, threads); i < end; ++i) {
+            particleCell[i] = newCells[i];
+            if (newCells[i] != NO_CELL) counts[newCells[i]]++;
+        }
+    });
+    // exclusive scan over the cells in two passes: every thread sums a block of cells, then
+    // offsets its block by the blocks before it. the histogram turns into where each slice
+    // starts inside the cell
+    runSlices(pool(), threads, [&](int t) {
+        uint32_t blockSum = 0;
+        for (size_t c = slice(numCells, t, threads), end = slice(numCells, t + 1, threads); c < end; ++c) {
+            uint32_t count = 0;
+            for (int s = 0; s < threads; ++s) {
+                uint32_t sliceCount = histogram[s * numCells + c];
+                histogram[s * numCells + c] = count;
+                count += sliceCount;
+            }
+            cellCount[c] = count;
+            blockSum += count;
+        }
+        blockSums[t] = blockSum;
+    });
+    runSlices(pool(), threads, [&](int t) {
+        uint32_t sum = 0;
+        for (int b = 0; b < t; ++b) sum += blockSums[b];
+        for (size_t c = slice(numCells, t, threads), end = slice(numCells, t + 1, threads); c < end; ++c) {
+            cellStart[c] = sum;
+            sum += cellCount[c];
+        }
+    });
+    runSlices(pool(), threads, [&](int t) {
+        uint32_t* offsets = histogram + t * numCells;
+        for (size_t i = slice(n, t, threads), end = slice(n, t + 1, threads); i < end; ++i) {
+            uint32_t c = newCells[i];
+            if (c != NO_CELL) sortedIndices[cellStart[c] + offsets[c]++] = static_cast<uint32_t>(i);
+        }
+    });
+}
+
+static constexpr int RADIX_BITS = 11, RADIX_PASSES = 6;
+static constexpr size_t RADIX_HISTOGRAM = size_t(RADIX_PASSES) << RADIX_BITS;
+
+// LSD radix sort of n (key, index) pairs on the key, 11 bits per pass, ping-ponging between
+// data and scratch. passes where every key has the same digit are skipped, which is most of
+// them for the packed cell keys. returns whichever of the two holds the sorted pairs.
+// histograms holds RADIX_HISTOGRAM counts per thread, each thread counts a slice of the
+// keys on workers, the scatters are serial
+static std::pair<uint64_t, uint32_t>* radixSortByKey(std::pair<uint64_t, uint32_t>* data,
+                                                     std::pair<uint64_t, uint32_t>* scratch,
+                                                     size_t n, uint32_t* histograms, ThreadPool& workers, int threads) {
+    const int bits = RADIX_BITS, passes = RADIX_PASSES;
+    const uint32_t buckets = 1u << bits;
+    runSlices(workers, threads, [&](int t) {
+        uint32_t* own = histograms + t * RADIX_HISTOGRAM;
+        std::fill(own, own + RADIX_HISTOGRAM, 0u);
+        for (size_t k = slice(n, t, threads), end = slice(n, t + 1, threads); k < end; ++k) {
+            for (int p = 0; p < passes; ++p) own[p * buckets + ((data[k].first >> (p * bits)) & (buckets - 1))]++;
+        }
+    });
+    uint32_t* histogram = histograms;
+    for (int t = 1; t < threads; ++t) {
+        for (size_t b = 0; b < RADIX_HISTOGRAM; ++b) histogram[b] += histograms[t * RADIX_HISTOGRAM + b];
+    }
+    for (int p = 0; p < passes; ++p) {
+        uint32_t* counts = &histogram[p * buckets];
+        if (n == 0 || counts[(data[0].first >> (p * bits)) & (buckets - 1)] == n) continue;
+        uint32_t sum = 0;
+        for (uint32_t b = 0; b < buckets; ++b) {
+            uint32_t count = counts[b];
+            counts[b] = sum;
+            sum += count;
+        }
+        for (size_t k = 0; k < n; ++k) scratch[counts[(data[k].first >> (p * bits)) & (buckets - 1)]++] = data[k];
+        std::swap(data, scratch);
+    }
+    return data;
+}
+
+uint32_t SPHSolver::findHashCell(uint64_t key) const {
+    size_t mask = hashTable.size() - 1;
+    for (size_t slot = mixCellKey(key) & mask;; slot = (slot + 1) & mask) {
+        uint32_t cell = hashTable[slot];
+        if (cell == NO_CELL || hashCellKeys[cell] == key) return cell;
+    }
+}
+
+void SPHSolver::buildHashGrid() {
+    // particleCell holds hash cell ids from here on, nothing to compare the next dense grid with
+    gridComparable = false;
+    size_t n = particles.size();
+    // room for the widest stencil on each side so the neighbour keys stay inside their field
+    const int maxCoord = CELL_KEY_BIAS - 1 - MAX_CELLS_PER_H;
+    ScratchArena& arena = scratchArenas[0];
+    ScratchScope scope(arena);
+    auto* keys = arena.allocate<std::pair<uint64_t, uint32_t>>(n);
+    size_t live = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (!particles.alive[i]) continue;
+        GridCoord cell = predictedCell(i);
+        cell.x = std::clamp(cell.x, -maxCoord, maxCoord);
+        cell.y = std::clamp(cell.y, -maxCoord, maxCoord);
+        cell.z = std::clamp(cell.z, -maxCoord, maxCoord);
+        keys[live++] = {packCellKey(cell), static_cast<uint32_t>(i)};
+    }
+    int threads = sliceThreads(pool().size(), live);
+    keys = radixSortByKey(keys, arena.allocate<std::pair<uint64_t, uint32_t>>(live), live,
+                          arena.allocate<uint32_t>(threads * RADIX_HISTOGRAM), pool(), threads);
+
+    // one cell per run of equal keys, dead slots are in no cell
+    sortedIndices.resize(live);
+    particleCell.assign(n, NO_CELL);
+    hashCellKeys.clear();
+    cellStart.clear();
+    cellCount.clear();
+    for (size_t k = 0; k < live; ++k) {
+        uint64_t key = keys[k].first;
+        if (hashCellKeys.empty() || hashCellKeys.back() != key) {
+            hashCellKeys.push_back(key);
+            cellStart.push_back(static_cast<uint32_t>(k));
+            cellCount.push_back(0);
+        }
+        cellCount.back()++;
+        sortedIndices[k] = keys[k].second;
+        particleCell[keys[k].second] = static_cast<uint32_t>(hashCellKeys.size() - 1);
+    }
+
+    size_t numCells = hashCellKeys.size();
+    size_t capacity = 16;
+    while (capacity < 2 * numCells) capacity <<= 1;
+    hashTable.assign(capacity, NO_CELL);
+    for (size_t c = 0; c < numCells; ++c) {
+        size_t slot = mixCellKey(hashCellKeys[c]) & (capacity - 1);
+        while (hashTable[slot] != NO_CELL) slot = (slot + 1) & (capacity - 1);
+        hashTable[slot] = static_cast<uint32_t>(c);
+    }
+
+    // neighbour cells are looked up once per cell instead of once per particle, keys of
+    // adjacent cells differ by one step in the matching field since coordinates are clamped
+    // well inside the field range
+    const uint64_t stepY = 1ull << CELL_KEY_BITS, stepZ = 1ull << (2 * CELL_KEY_BITS);
+    const size_t stride = stencil->cellCount;
+    hashNeighbourCells.resize(stride * numCells);
+    for (size_t c = 0; c < numCells; ++c) {
+        uint32_t* cells = &hashNeighbourCells[stride * c];
+        for (size_t k = 0; k < stride; ++k) {
+            const StencilCell& d = stencil->cells[k];
+            uint64_t key = hashCellKeys[c] + d.dz * stepZ + d.dy * stepY + d.dx;
+            cells[k] = findHashCell(key);
+        }
+    }
+}
+
+size_t SPHSolver::getSearchMemory() const {
+    auto bytes = [](const auto& v) { return v.capacity() * sizeof(v[0]); };
+    return bytes(cellStart) + bytes(cellCount) + bytes(sortedIndices) + bytes(particleCell) +
+           bytes(hashCellKeys) + bytes(hashTable) + bytes(hashNeighbourCells);
+}
+
+size_t SPHSolver::getScratchHighWater() const {
+    size_t total = 0;
+    for (const ScratchArena& arena : scratchArenas) total += arena.highWater();
+    return total;
+}
+
+size_t SPHSolver::getScratchCapacity() const {
+    size_t total = 0;
+    for (const ScratchArena& arena : scratchArenas) total += arena.capacity();
+    return total;
+}
+
+void SPHSolver::getMemoryReport(MemoryReport& report) const {
+    report.clear();
+    size_t bytes = 0, capacity = 0;
+    auto vectors = [&](const auto&... v) {
+        bytes = (0 + ... + (v.size() * sizeof(v[0])));
+        capacity = (0 + ... + (v.capacity() * sizeof(v[0])));
+    };
+    report.add("particles", particles.sizeBytes(), particles.capacityBytes());
+    vectors(particleIds, particleSlots, freeSlots, freeIds);
+    report.add("ids", bytes, capacity);
+    vectors(cellStart, cellCount, sortedIndices, particleCell);
+    report.add("grid", bytes, capacity);
+    vectors(hashCellKeys, hashTable, hashNeighbourCells);
+    report.add("hash", bytes, capacity);
+    vectors(verletOffsets, verletNeighbours, verletBase, verletPacked, verletRow);
+    report.add("verlet", bytes + verletBuildPositions.sizeBytes(), capacity + verletBuildPositions.capacityBytes());
+    vectors(pairOffsets, pairCache);
+    report.add("pair cache", bytes, capacity);
+    vectors(particleView);
+    report.add("view", bytes, capacity);
+    vectors(threadCellBegin, threadNudges, threadMarks);
+    for (const auto& nudges : threadNudges) {
+        bytes += nudges.size() * sizeof(nudges[0]);
+        capacity += nudges.capacity() * sizeof(nudges[0]);
+    }
+    report.add("threads", bytes, capacity);
+    report.add("scratch", getScratchHighWater(), getScratchCapacity());
+}
+
+void SPHSolver::setPagePolicy(HugePages hugePages, bool numaFirst) {
+    numaFirstTouch = numaFirst;
+    PagePolicy policy{hugePages, {}};
+    if (numaFirstTouch) {
+        touchedThreads = pool().size();
+        // worker t writes the pages under slice t of the mapping, which is slice t of the
+        // particles for every array of the capacity. the policy outlives the solver, so it
+        // only holds on to the pool weakly
+        std::weak_ptr<ThreadPool> weakPool = threadPool;
+        policy.firstTouch = [weakPool](std::byte* data, size_t bytes, size_t pageSize) {
+            std::shared_ptr<ThreadPool> workers = weakPool.lock();
+            int threads = workers ? workers->size() : 1;
+            auto touch = [&](int t) {
+                size_t begin = (slice(bytes, t, threads) + pageSize - 1) / pageSize * pageSize;
+                size_t end = std::min((slice(bytes, t + 1, threads) + pageSize - 1) / pageSize * pageSize, bytes);
+                for (size_t b = begin; b < end; b += pageSize) data[b] = std::byte{0};
+            };
+            if (workers) workers->run(touch);
+            else touch(0);
+        };
+    }
+    ::setPagePolicy(policy);
+    particles.reallocate();
+}
+
+void SPHSolver::resetScratch() {
+    for (ScratchArena& arena : scratchArenas) arena.reset();
+}
+
+int SPHSolver::calibrateCellResolution(float dt, int steps) {
+    int best = cellsPerH;
+    double bestMs = 0.0;
+    for (int r = 1; r <= MAX_CELLS_PER_H; ++r) {
+        // a copy, so the run does not advance the real simulation. the first step warms up
+        // the grid buffers and is not timed
+        SPHSolver trial = *this;
+        trial.cellsPerH = r;
+        trial.update(dt);
+        auto start = std::chrono::steady_clock::now();
+        for (int s = 0; s < steps; ++s) trial.update(dt);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (r == 1 || ms < bestMs) {
+            best = r;
+            bestMs = ms;
+        }
+    }
+    cellsPerH = best;
+    return best;
+}
+
+bool SPHSolver::verletNeedsRebuild() {
+    verletStats.steps++;
+    size_t n = particles.size();
+    if (verletOffsets.size() != n + 1 || verletBuildPositions.x.size() != particles.paddedSize() ||
+        verletBuildH != h || verletBuildSkin != verletSkin || verletBuildCompressed != compressVerletLists) {
+        return true;
+    }
+    const float* px = particles.predicted.x.data();
+    const float* py = particles.predicted.y.data();
+    const float* pz = particles.predicted.z.data();
+    const float* bx = verletBuildPositions.x.data();
+    const float* by = verletBuildPositions.y.data();
+    const float* bz = verletBuildPositions.z.data();
+    float maxDist2 = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        float dx = px[i] - bx[i], dy = py[i] - by[i], dz = pz[i] - bz[i];
+        maxDist2 = std::max(maxDist2, dx * dx + dy * dy + dz * dz);
     }
+    verletStats.maxDisplacement = std::sqrt(maxDist2);
+    verletStats.stepsSinceRebuild++;
+    // two particles moving towards each other close the gap by twice the displacement
+    float limit = 0.5f * verletSkin;
+    return maxDist2 > limit * limit;
+}
+
+void SPHSolver::buildVerletLists() {
+    size_t n = particles.size();
+    float r = h + verletSkin;
+    float r2 = r * r;
+    verletOffsets.resize(n + 1);
+    // only one of the formats is kept, the other one gives its memory back
+    if (compressVerletLists) {
+        std::vector<uint32_t>().swap(verletNeighbours);
+        verletBase.resize(n);
+        verletPacked.clear();
+    } else {
+        std::vector<uint32_t>().swap(verletBase);
+        std::vector<uint16_t>().swap(verletPacked);
+        verletNeighbours.clear();
+    }
+    size_t inRange = 0, entries = 0, wide = 0;
+    verletOffsets[0] = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const glm::vec3 pos = particles.predicted.get(i);
+        verletRow.clear();
+        forEachGridNeighbour(i, [&](uint32_t j) {
+            glm::vec3 r_ij = pos - particles.predicted.get(j);
+            float d2 = glm::dot(r_ij, r_ij);
+            if (d2 < r2) verletRow.push_back(j);
+            if (d2 < h * h) inRange++;
+        });
+        entries += verletRow.size();
+        if (!compressVerletLists) {
+            verletNeighbours.insert(verletNeighbours.end(), verletRow.begin(), verletRow.end());
+            verletOffsets[i + 1] = static_cast<uint32_t>(verletNeighbours.size());
+            continue;
+        }
+        // the list of a live particle holds i itself, only dead slots have empty lists
+        auto [lo, hi] = std::minmax_element(verletRow.begin(), verletRow.end());
+        uint32_t base = verletRow.empty() ? 0 : *lo;
+        if (verletRow.empty() || *hi - base <= 0xffffu) {
+            for (uint32_t j : verletRow) verletPacked.push_back(static_cast<uint16_t>(j - base));
+        } else {
+            base = VERLET_WIDE;
+            wide++;
+            for (uint32_t j : verletRow) {
+                verletPacked.push_back(static_cast<uint16_t>(j));
+                verletPacked.push_back(static_cast<uint16_t>(j >> 16));
+            }
+        }
+        verletBase[i] = base;
+        verletOffsets[i + 1] = static_cast<uint32_t>(verletPacked.size());
+    }
+    verletBuildPositions = particles.predicted;
+    verletBuildH = h;
+    verletBuildSkin = verletSkin;
+    verletBuildCompressed = compressVerletLists;
+
+    verletStats.rebuilds++;
+    verletStats.stepsSinceRebuild = 0;
+    verletStats.maxDisplacement = 0.0f;
+    verletStats.listEntries = entries;
+    verletStats.pairsInRange = inRange;
+    verletStats.wideLists = wide;
+    verletStats.listBytes = verletOffsets.size() * sizeof(uint32_t) + verletNeighbours.size() * sizeof(uint32_t) +
+                            verletBase.size() * sizeof(uint32_t) + verletPacked.size() * sizeof(uint16_t);
+}
+
+template <typename F>
+void SPHSolver::forEachParticleBalanced(F&& fn) {
+    ThreadPool& workers = pool();
+    size_t numCells = cellCount.size();
+    size_t cellsPerBlock = std::max<size_t>(numCells / (static_cast<size_t>(workers.size()) * BLOCKS_PER_WORKER), 1);
+    size_t blockCount = (numCells + cellsPerBlock - 1) / cellsPerBlock;
+    ScratchScope scope(scratchArenas[0]);
+    uint64_t* weights = scratchArenas[0].allocate<uint64_t>(blockCount);
+    // a particle costs about one kernel evaluation per candidate, the particles of a cell all
+    // test the same candidates
+    workers.parallelFor(0, blockCount, 1, [&](size_t begin, size_t end, int) {
+        for (size_t b = begin; b < end; ++b) {
+            uint64_t weight = 0;
+            for (size_t c = b * cellsPerBlock, last = std::min(c + cellsPerBlock, numCells); c < last; ++c) {
+                if (cellCount[c] > 0) weight += static_cast<uint64_t>(cellCount[c]) * cellCandidates(static_cast<uint32_t>(c));
+            }
+            weights[b] = weight;
+        }
+    });
+    workers.runStealing(blockCount, weights, [&](uint32_t b, int t) {
+        size_t first = b * cellsPerBlock, last = std::min(first + cellsPerBlock, numCells) - 1;
+        for (uint32_t k = cellStart[first], end = cellStart[last] + cellCount[last]; k < end; ++k) fn(sortedIndices[k], t);
+    });
+}
+
+uint32_t SPHSolver::cellCandidates(uint32_t c) const {
+    int cx = static_cast<int>(c % gridDims.x);
+    int cy = static_cast<int>((c / gridDims.x) % gridDims.y);
+    int cz = static_cast<int>(c / (gridDims.x * gridDims.y));
+    uint32_t candidates = 0;
+    for (int r = 0; r < stencil->rowCount; ++r) {
+        const StencilRow& row = stencil->rows[r];
+        int y = cy + row.dy, z = cz + row.dz;
+        if (y < 0 || y >= gridDims.y || z < 0 || z >= gridDims.z) continue;
+        uint32_t first = getCellIndex({std::max(cx + row.dxMin, 0), y, z});
+        uint32_t last = getCellIndex({std::min(cx + row.dxMax, gridDims.x - 1), y, z});
+        candidates += cellStart[last] + cellCount[last] - cellStart[first];
+    }
+    return candidates;
 }
 
 void SPHSolver::computeDensityPressure() {
-    for (size_t i = 0; i < particles.size(); i++) {
-        densities[i] = 0.0f;
-        auto neighbours = getNeighbours(i);
-        for (uint32_t j : neighbours) {
-            glm::vec3 r_ij = predictedPositions[i] - predictedPositions[j];
+    if (useSymmetricPairs) {
+        computeDensityPressureSymmetric();
+        return;
+    }
+    if (usesTiles()) {
+        computeDensityPressureTiled();
+        return;
+    }
+    size_t n = particles.size();
+    bool caching = usePairCache;
+    size_t maxPairs = 0;
+    if (caching) {
+        pairOffsets.resize(n + 1);
+        pairOffsets[0] = 0;
+        size_t offsetBytes = pairOffsets.capacity() * sizeof(uint32_t);
+        maxPairs = pairCacheBudget > offsetBytes ? (pairCacheBudget - offsetBytes) / sizeof(CachedPair) : 0;
+        // the budget was lowered, give the memory back
+        if (pairCache.capacity() > maxPairs) std::vector<CachedPair>().swap(pairCache);
+        pairCache.clear();
+    }
+    uint32_t cached = 0;
+
+    // onPair(j, r2, r_ij) is called for every other particle in range of i
+    auto densityAt = [&](size_t i, auto&& onPair) {
+        const glm::vec3 pos = particles.predicted.get(i);
+        float density = 0.0f;
+        forEachNeighbour(i, [&](uint32_t j) {
+            glm::vec3 r_ij = pos - particles.predicted.get(j);
             float r2 = glm::dot(r_ij, r_ij);
-            if (r2 < h * h) densities[i] += mass * poly6_kernel(r2);
+            if (r2 >= h * h) return;
+            density += mass * poly6_kernel(r2);
+            if (j != i) onPair(j, r2, r_ij);
+        });
+        particles.density[i] = density;
+        particles.pressure[i] = std::max(pressure_multiplier * (density - restDensity), 0.0f);
+    };
+
+    if (!caching && usesWorkStealing()) {
+        forEachParticleBalanced([&](uint32_t i, int) { densityAt(i, [](uint32_t, float, const glm::vec3&) {}); });
+    } else if (!caching) {
+        forEachParticleRange(n, 1, [&](size_t begin, size_t end, int) {
+            for (size_t i = begin; i < end; ++i) densityAt(i, [](uint32_t, float, const glm::vec3&) {});
+        });
+    } else {
+        // the cache is filled in particle order, so this stays on one thread
+        for (size_t i = 0; i < n; i++) {
+            size_t rowStart = pairCache.size();
+            densityAt(i, [&](uint32_t j, float r2, const glm::vec3& r_ij) {
+                if (!caching) return;
+                if (pairCache.size() == pairCache.capacity()) {
+                    // grow by hand so the capacity stops at the budget
+                    if (pairCache.size() >= maxPairs) {
+                        pairCache.resize(rowStart);
+                        caching = false;
+                        return;
+                    }
+                    pairCache.reserve(std::min(maxPairs, std::max<size_t>(1024, 2 * pairCache.capacity())));
+                }
+                pairCache.push_back({j, std::sqrt(r2), r_ij});
+            });
+            if (caching) pairOffsets[++cached] = static_cast<uint32_t>(pairCache.size());
         }
-        pressures[i] = pressure_multiplier * (densities[i] - restDensity);
-        if (pressures[i] < 0.0f) pressures[i] = 0.0f;
     }
+
+    pairCacheStats.pairs = pairCache.size();
+    pairCacheStats.cachedParticles = usePairCache ? cached : 0;
+    pairCacheStats.bytes = pairCache.capacity() * sizeof(CachedPair) + pairOffsets.capacity() * sizeof(uint32_t);
 }
 
 void SPHSolver::computeForces() {
-    for (size_t i = 0; i < particles.size(); i++) {
+    if (useSymmetricPairs) {
+        computeForcesSymmetric();
+        return;
+    }
+    if (usesTiles()) {
+        computeForcesTiled();
+        return;
+    }
+    uint32_t cached = usePairCache ? pairCacheStats.cachedParticles : 0;
+    const StoredFloat* densities = particles.density.data();
+    const StoredFloat* pressures = particles.pressure.data();
+    ThreadPool& workers = pool();
+    threadNudges.resize(workers.size());
+    for (auto& nudges : threadNudges) nudges.clear();
+    auto forceAt = [&](size_t i, int t) {
+        std::vector<std::pair<uint32_t, uint32_t>>& nudges = threadNudges[t];
+        const glm::vec3 vel = particles.velocity.get(i);
         glm::vec3 fPressure(0.0f);
         glm::vec3 fViscosity(0.0f);
-        auto neighbours = getNeighbours(i);
-        for (uint32_t j : neighbours) {
-            if (i == j) continue;
-            glm::vec3 r_ij = predictedPositions[i] - predictedPositions[j];
-            float rlen = glm::length(r_ij);
-            if (rlen < 1e-4f) {
-                // chose a random direction to avoid division by zero
-                glm::vec3 randomDir = glm::vec3(0.0f, 1.0f, 0.0f);
-                float epsDist = epsilon * h;
-                particles[i].position += 0.5f * epsDist * randomDir;
-                particles[j].position -= 0.5f * epsDist * randomDir;
-            }
+        auto addPair = [&](uint32_t j, const glm::vec3& r_ij, float rlen) {
+            // coincident particles are pushed apart after the step, recorded from the lower
+            // index so the pair is seen once
+            if (rlen < 1e-4f && i < j) nudges.push_back({static_cast<uint32_t>(i), j});
             if (rlen < h && rlen > 1e-4f) {
-                fPressure += -mass * (pressures[i] + pressures[j]) / (2.0f * densities[j]) *
+                float densityJ = densities[j];
+                fPressure += -mass * (pressures[i] + pressures[j]) / (2.0f * densityJ) *
                              spiky_grad(r_ij, rlen);
-                fViscosity += viscosity * mass * (particles[j].velocity - particles[i].velocity) / densities[j] *
+                fViscosity += viscosity * mass * (particles.velocity.get(j) - vel) / densityJ *
                               visc_lap(rlen);
             }
+        };
+        if (i < cached) {
+            for (uint32_t k = pairOffsets[i]; k < pairOffsets[i + 1]; ++k) {
+                addPair(pairCache[k].j, pairCache[k].r_ij, pairCache[k].rlen);
+            }
+        } else {
+            forEachNeighbour(i, [&](uint32_t j) {
+                if (i == j) return;
+                glm::vec3 r_ij = particles.predicted.get(i) - particles.predicted.get(j);
+                addPair(j, r_ij, glm::length(r_ij));
+            });
         }
         glm::vec3 fGravity(0.0f, gravity_m * densities[i], 0.0f);
-        forces[i] = fPressure + fViscosity + fGravity;
+        particles.force.set(i, fPressure + fViscosity + fGravity);
+    };
+    if (usesWorkStealing()) {
+        forEachParticleBalanced(forceAt);
+    } else {
+        forEachParticleRange(particles.size(), 1, [&](size_t begin, size_t end, int t) {
+            for (size_t i = begin; i < end; i++) forceAt(i, t);
+        });
+    }
+}
+
+ThreadPool& SPHSolver::pool() {
+    if (!threadPool) threadPool = std::make_shared<ThreadPool>();
+    threadPool->resize(numThreads);
+    return *threadPool;
+}
+
+void SPHSolver::splitCellsByParticles(int threads) {
+    // contiguous cell ranges holding about the same number of live particles
+    size_t n = sortedIndices.size();
+    threadCellBegin.resize(threads + 1);
+    threadCellBegin[0] = 0;
+    for (int t = 1; t < threads; ++t) {
+        uint32_t target = static_cast<uint32_t>(n * t / threads);
+        auto it = std::lower_bound(cellStart.begin(), cellStart.end(), target);
+        threadCellBegin[t] = std::max(threadCellBegin[t - 1], static_cast<uint32_t>(it - cellStart.begin()));
+    }
+    threadCellBegin[threads] = static_cast<uint32_t>(cellCount.size());
+}
+
+void SPHSolver::openThreadScratch(int threads) {
+    // arenas are only ever added, a worker keeps its arena and with it the warmed up block
+    if (scratchArenas.size() < static_cast<size_t>(threads)) scratchArenas.resize(threads);
+    threadMarks.resize(threads);
+    for (int t = 0; t < threads; ++t) threadMarks[t] = scratchArenas[t].mark();
+}
+
+void SPHSolver::closeThreadScratch() {
+    for (size_t t = 0; t < threadMarks.size(); ++t) scratchArenas[t].rewind(threadMarks[t]);
+}
+
+void SPHSolver::computeDensityPressureSymmetric() {
+    size_t n = particles.size();
+    ThreadPool& workers = pool();
+    int threads = workers.size();
+    splitCellsByParticles(threads);
+    openThreadScratch(threads);
+    threadDensities.resize(threads);
+    const float selfDensity = mass * poly6_kernel(0.0f);
+
+    workers.run([&](int t) {
+        float* acc = scratchArenas[t].allocate<float>(n);
+        std::fill(acc, acc + n, 0.0f);
+        threadDensities[t] = acc;
+        forEachPairInCells(threadCellBegin[t], threadCellBegin[t + 1], [&](uint32_t i, uint32_t j) {
+            glm::vec3 r_ij = particles.predicted.get(i) - particles.predicted.get(j);
+            float r2 = glm::dot(r_ij, r_ij);
+            if (r2 < h * h) {
+                float w = mass * poly6_kernel(r2);
+                acc[i] += w;
+                acc[j] += w;
+            }
+        });
+    });
+
+    forEachParticleRange(n, 1, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i) {
+            float density = selfDensity;
+            for (int t = 0; t < threads; ++t) density += threadDensities[t][i];
+            particles.density[i] = density;
+            particles.pressure[i] = std::max(pressure_multiplier * (density - restDensity), 0.0f);
+        }
+    });
+    closeThreadScratch();
+}
+
+void SPHSolver::computeForcesSymmetric() {
+    size_t n = particles.size();
+    ThreadPool& workers = pool();
+    int threads = static_cast<int>(threadDensities.size());
+    const StoredFloat* densities = particles.density.data();
+    const StoredFloat* pressures = particles.pressure.data();
+    openThreadScratch(threads);
+    threadForces.resize(threads);
+    threadNudges.resize(threads);
+
+    workers.run([&](int t) {
+        glm::vec3* acc = scratchArenas[t].allocate<glm::vec3>(n);
+        std::fill(acc, acc + n, glm::vec3(0.0f));
+        threadForces[t] = acc;
+        threadNudges[t].clear();
+        forEachPairInCells(threadCellBegin[t], threadCellBegin[t + 1], [&](uint32_t i, uint32_t j) {
+            glm::vec3 r_ij = particles.predicted.get(i) - particles.predicted.get(j);
+            float rlen = glm::length(r_ij);
+            // coincident particles are pushed apart after the step
+            if (rlen < 1e-4f) threadNudges[t].push_back({i, j});
+            if (rlen < h && rlen > 1e-4f) {
+                glm::vec3 grad = spiky_grad(r_ij, rlen);
+                float lap = visc_lap(rlen);
+                float pressureSum = pressures[i] + pressures[j];
+                float densityI = densities[i], densityJ = densities[j];
+                glm::vec3 dv = particles.velocity.get(j) - particles.velocity.get(i);
+                acc[i] += -mass * pressureSum / (2.0f * densityJ) * grad +
+                          viscosity * mass * dv / densityJ * lap;
+                acc[j] += mass * pressureSum / (2.0f * densityI) * grad -
+                          viscosity * mass * dv / densityI * lap;
+            }
+        });
+    });
+
+    forEachParticleRange(n, 1, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i) {
+            glm::vec3 force(0.0f, gravity_m * densities[i], 0.0f);
+            for (int t = 0; t < threads; ++t) force += threadForces[t][i];
+            particles.force.set(i, force);
+        }
+    });
+    closeThreadScratch();
+}
+
+void SPHSolver::gatherTile(GridTile& tile, ScratchArena& arena, bool withState) const {
+    const int reach = stencil->reach;
+    GridCoord haloEnd = {std::min(tile.end.x + reach, gridDims.x), std::min(tile.end.y + reach, gridDims.y),
+                         std::min(tile.end.z + reach, gridDims.z)};
+    tile.haloBegin = {std::max(tile.begin.x - reach, 0), std::max(tile.begin.y - reach, 0), std::max(tile.begin.z - reach, 0)};
+    tile.haloDims = {haloEnd.x - tile.haloBegin.x, haloEnd.y - tile.haloBegin.y, haloEnd.z - tile.haloBegin.z};
+
+    // the cells of a row are consecutive in sortedIndices, so a row is one range
+    auto rowRange = [&](int y, int z) {
+        uint32_t first = getCellIndex({tile.haloBegin.x, y, z});
+        uint32_t last = getCellIndex({haloEnd.x - 1, y, z});
+        return std::pair<uint32_t, uint32_t>(cellStart[first], cellStart[last] + cellCount[last]);
+    };
+    uint32_t count = 0;
+    for (int z = tile.haloBegin.z; z < haloEnd.z; ++z) {
+        for (int y = tile.haloBegin.y; y < haloEnd.y; ++y) {
+            auto [begin, end] = rowRange(y, z);
+            count += end - begin;
+        }
+    }
+    size_t cells = static_cast<size_t>(tile.haloDims.x) * tile.haloDims.y * tile.haloDims.z;
+    tile.count = count;
+    tile.cellStart = arena.allocate<uint32_t>(cells + 1);
+    tile.index = arena.allocate<uint32_t>(count);
+    tile.x = arena.allocate<float>(count);
+    tile.y = arena.allocate<float>(count);
+    tile.z = arena.allocate<float>(count);
+    if (withState) {
+        tile.vx = arena.allocate<float>(count);
+        tile.vy = arena.allocate<float>(count);
+        tile.vz = arena.allocate<float>(count);
+        tile.density = arena.allocate<float>(count);
+        tile.pressure = arena.allocate<float>(count);
+    }
+
+    uint32_t local = 0, cell = 0;
+    for (int z = tile.haloBegin.z; z < haloEnd.z; ++z) {
+        for (int y = tile.haloBegin.y; y < haloEnd.y; ++y) {
+            auto [begin, end] = rowRange(y, z);
+            for (int x = tile.haloBegin.x; x < haloEnd.x; ++x) {
+                tile.cellStart[cell++] = local + (cellStart[getCellIndex({x, y, z})] - begin);
+            }
+            for (uint32_t k = begin; k < end; ++k, ++local) {
+                uint32_t i = sortedIndices[k];
+                tile.index[local] = i;
+                tile.x[local] = particles.predicted.x[i];
+                tile.y[local] = particles.predicted.y[i];
+                tile.z[local] = particles.predicted.z[i];
+                if (!withState) continue;
+                tile.vx[local] = particles.velocity.x[i];
+                tile.vy[local] = particles.velocity.y[i];
+                tile.vz[local] = particles.velocity.z[i];
+                tile.density[local] = particles.density[i];
+                tile.pressure[local] = particles.pressure[i];
+            }
+        }
+    }
+    tile.cellStart[cells] = local;
+}
+
+template <typename F>
+void SPHSolver::forEachTile(bool withState, F&& pass) {
+    const int edge = std::max(tileCells, 1);
+    const GridCoord tiles = {(gridDims.x + edge - 1) / edge, (gridDims.y + edge - 1) / edge, (gridDims.z + edge - 1) / edge};
+    const uint32_t tileCount = static_cast<uint32_t>(tiles.x * tiles.y * tiles.z);
+    // slot and predicted position, then velocity, density and pressure
+    const size_t bytesPerParticle = 4 * sizeof(float) + (withState ? 5 * sizeof(StoredFloat) : 0);
+    ThreadPool& workers = pool();
+    openThreadScratch(workers.size());
+    std::atomic<uint32_t> nextTile{0};
+    std::atomic<size_t> usedTiles{0}, gathered{0}, largest{0};
+
+    workers.run([&](int t) {
+        size_t ownTiles = 0, ownGathered = 0, ownLargest = 0;
+        for (uint32_t k = nextTile++; k < tileCount; k = nextTile++) {
+            GridTile tile;
+            int tx = static_cast<int>(k % tiles.x), ty = static_cast<int>((k / tiles.x) % tiles.y), tz = static_cast<int>(k / (tiles.x * tiles.y));
+            tile.begin = {tx * edge, ty * edge, tz * edge};
+            tile.end = {std::min(tile.begin.x + edge, gridDims.x), std::min(tile.begin.y + edge, gridDims.y),
+                        std::min(tile.begin.z + edge, gridDims.z)};
+            uint32_t first = getCellIndex(tile.begin);
+            uint32_t last = getCellIndex({tile.end.x - 1, tile.end.y - 1, tile.end.z - 1});
+            // no particle anywhere from the first to the last cell of the block
+            if (cellStart[first] == cellStart[last] + cellCount[last]) continue;
+            ScratchScope scope(scratchArenas[t]);
+            gatherTile(tile, scratchArenas[t], withState);
+            pass(tile, t);
+            ownTiles++;
+            ownGathered += tile.count;
+            size_t cells = static_cast<size_t>(tile.haloDims.x) * tile.haloDims.y * tile.haloDims.z;
+            ownLargest = std::max(ownLargest, tile.count * bytesPerParticle + (cells + 1) * sizeof(uint32_t));
+        }
+        usedTiles += ownTiles;
+        gathered += ownGathered;
+        size_t seen = largest.load();
+        while (ownLargest > seen && !largest.compare_exchange_weak(seen, ownLargest)) {}
+    });
+    closeThreadScratch();
+
+    tileStats.tiles = usedTiles;
+    tileStats.gatheredParticles += gathered;
+    tileStats.gatheredBytes += gathered * bytesPerParticle;
+    tileStats.largestTileBytes = largest;
+}
+
+// calls f(a, b) for every particle b of the tile in the stencil cells around particle a
+template <typename F>
+static void forEachTileNeighbour(const GridTile& tile, const GridStencil& stencil, const GridCoord& gridDims,
+                                 int cx, int cy, int cz, uint32_t a, F&& f) {
+    for (int r = 0; r < stencil.rowCount; ++r) {
+        const StencilRow& row = stencil.rows[r];
+        int y = cy + row.dy, z = cz + row.dz;
+        if (y < 0 || y >= gridDims.y || z < 0 || z >= gridDims.z) continue;
+        uint32_t first = tile.localCell(std::max(cx + row.dxMin, 0), y, z);
+        uint32_t last = tile.localCell(std::min(cx + row.dxMax, gridDims.x - 1), y, z);
+        for (uint32_t b = tile.cellStart[first]; b < tile.cellStart[last + 1]; ++b) f(a, b);
+    }
+}
+
+// calls f(a, cx, cy, cz) for every particle a the tile owns
+template <typename F>
+static void forEachOwnedParticle(const GridTile& tile, F&& f) {
+    for (int cz = tile.begin.z; cz < tile.end.z; ++cz) {
+        for (int cy = tile.begin.y; cy < tile.end.y; ++cy) {
+            for (int cx = tile.begin.x; cx < tile.end.x; ++cx) {
+                uint32_t cell = tile.localCell(cx, cy, cz);
+                for (uint32_t a = tile.cellStart[cell]; a < tile.cellStart[cell + 1]; ++a) f(a, cx, cy, cz);
+            }
+        }
+    }
+}
+
+void SPHSolver::computeDensityPressureTiled() {
+    tileStats.gatheredParticles = tileStats.gatheredBytes = 0;
+    forEachTile(false, [&](const GridTile& tile, int) {
+        forEachOwnedParticle(tile, [&](uint32_t a, int cx, int cy, int cz) {
+            const glm::vec3 pos(tile.x[a], tile.y[a], tile.z[a]);
+            float density = 0.0f;
+            forEachTileNeighbour(tile, *stencil, gridDims, cx, cy, cz, a, [&](uint32_t, uint32_t b) {
+                glm::vec3 r_ij = pos - glm::vec3(tile.x[b], tile.y[b], tile.z[b]);
+                float r2 = glm::dot(r_ij, r_ij);
+                if (r2 >= h * h) return;
+                density += mass * poly6_kernel(r2);
+            });
+            uint32_t i = tile.index[a];
+            particles.density[i] = density;
+            particles.pressure[i] = std::max(pressure_multiplier * (density - restDensity), 0.0f);
+        });
+    });
+}
+
+void SPHSolver::computeForcesTiled() {
+    threadNudges.resize(pool().size());
+    for (auto& nudges : threadNudges) nudges.clear();
+    forEachTile(true, [&](const GridTile& tile, int t) {
+        forEachOwnedParticle(tile, [&](uint32_t a, int cx, int cy, int cz) {
+            const glm::vec3 pos(tile.x[a], tile.y[a], tile.z[a]);
+            const glm::vec3 vel(tile.vx[a], tile.vy[a], tile.vz[a]);
+            const uint32_t i = tile.index[a];
+            glm::vec3 fPressure(0.0f);
+            glm::vec3 fViscosity(0.0f);
+            forEachTileNeighbour(tile, *stencil, gridDims, cx, cy, cz, a, [&](uint32_t, uint32_t b) {
+                if (a == b) return;
+                glm::vec3 r_ij = pos - glm::vec3(tile.x[b], tile.y[b], tile.z[b]);
+                float rlen = glm::length(r_ij);
+                if (rlen < 1e-4f && i < tile.index[b]) threadNudges[t].push_back({i, tile.index[b]});
+                if (rlen < h && rlen > 1e-4f) {
+                    float densityJ = tile.density[b];
+                    fPressure += -mass * (tile.pressure[a] + tile.pressure[b]) / (2.0f * densityJ) *
+                                 spiky_grad(r_ij, rlen);
+                    fViscosity += viscosity * mass * (glm::vec3(tile.vx[b], tile.vy[b], tile.vz[b]) - vel) / densityJ *
+                                  visc_lap(rlen);
+                }
+            });
+            glm::vec3 fGravity(0.0f, gravity_m * tile.density[a], 0.0f);
+            particles.force.set(i, fPressure + fViscosity + fGravity);
+        });
+    });
+}
+
+void SPHSolver::applyNudges() {
+    size_t pairs = 0;
+    for (const auto& nudges : threadNudges) pairs += nudges.size();
+    if (pairs == 0) return;
+    // the net push of a particle is a whole number of half steps, summed first so it does
+    // not depend on which thread found which pair or in what order
+    size_t n = particles.size();
+    ScratchScope scope(scratchArenas[0]);
+    int32_t* net = scratchArenas[0].allocate<int32_t>(n);
+    std::fill(net, net + n, 0);
+    for (const auto& nudges : threadNudges) {
+        for (const auto& [i, j] : nudges) {
+            net[i]++;
+            net[j]--;
+        }
+    }
+    // chose a fixed direction to avoid division by zero
+    float halfStep = 0.5f * epsilon * h;
+    for (size_t i = 0; i < n; ++i) {
+        if (net[i] != 0) particles.position.add(i, glm::vec3(0.0f, halfStep * net[i], 0.0f));
     }
 }
 
@@ -78,50 +1184,100 @@ void SPHSolver::integrate(float dt) {
     prevBoxPos = boxPos;
     prevBoxSize = boxSize;
 
-    for (size_t i = 0; i < particles.size(); i++) {
-        // euler integration
-        particles[i].velocity += dt * (forces[i] / mass);
-        float speed = glm::length(particles[i].velocity);
-        speed = std::min(speed, max_speed);
-        particles[i].velocity = glm::normalize(particles[i].velocity) * speed;
-        particles[i].position += dt * particles[i].velocity;
+    // reads the current generation and writes the next one, every slot is written
+    size_t n = particles.size();
+    const StoredFloat* velIn[3] = {particles.velocity.x.data(), particles.velocity.y.data(), particles.velocity.z.data()};
+    StoredFloat* vel[3] = {particles.nextVelocity.x.data(), particles.nextVelocity.y.data(), particles.nextVelocity.z.data()};
+    const CellPositionArray& position = particles.position;
+    CellPositionArray& next = particles.nextPosition;
+    const int32_t* cellIn[3] = {position.cx.data(), position.cy.data(), position.cz.data()};
+    const float* offsetIn[3] = {position.offset.x.data(), position.offset.y.data(), position.offset.z.data()};
+    int32_t* cell[3] = {next.cx.data(), next.cy.data(), next.cz.data()};
+    float* offset[3] = {next.offset.x.data(), next.offset.y.data(), next.offset.z.data()};
+    const float* frc[3] = {particles.force.x.data(), particles.force.y.data(), particles.force.z.data()};
+
+    // euler integration, the speed is clamped to max_speed. dead slots are held in place
+    const uint8_t* alive = particles.alive.data();
+    const float cs = position.cellSize;
+    glm::vec3 frameOrigin = position.frameOrigin();
+    ThreadPool& workers = pool();
+    ScratchScope scope(scratchArenas[0]);
+    float* threadFastest = scratchArenas[0].allocate<float>(workers.size());
+    std::fill(threadFastest, threadFastest + workers.size(), 0.0f);
+
+    forEachParticleRange(n, 1, [&](size_t begin, size_t end, int t) {
+        float fastest = 0.0f;
+        for (size_t i = begin; i < end; i++) {
+            float vx = velIn[0][i] + dt * (frc[0][i] / mass);
+            float vy = velIn[1][i] + dt * (frc[1][i] / mass);
+            float vz = velIn[2][i] + dt * (frc[2][i] / mass);
+            float speed = std::sqrt(vx * vx + vy * vy + vz * vz);
+            float scale = (speed > max_speed ? max_speed / speed : 1.0f) * alive[i];
+            fastest = std::max(fastest, std::min(speed, max_speed) * alive[i]);
+            vel[0][i] = vx * scale;
+            vel[1][i] = vy * scale;
+            vel[2][i] = vz * scale;
+        }
+        threadFastest[t] = std::max(threadFastest[t], fastest);
 
-        // Boundary conditions
+        // Boundary conditions, relative to the frame. the step goes into the offset and a
+        // particle that leaves its cell moves on to the next one
         for (int axis = 0; axis < 3; ++axis) {
-            if (particles[i].position[axis] - radius < minB[axis]) {
-                particles[i].position[axis] = minB[axis] + radius;
-                float relVel = particles[i].velocity[axis] - wallVelMin[axis] / restDensity;
-                particles[i].velocity[axis] = wallVelMin[axis] - relVel * bounce;
-            } else if (particles[i].position[axis] + radius > maxB[axis]) {
-                particles[i].position[axis] = maxB[axis] - radius;
-                float relVel = particles[i].velocity[axis] - wallVelMax[axis] / restDensity;
-                particles[i].velocity[axis] = wallVelMax[axis] - relVel * bounce;
+            const int32_t* cIn = cellIn[axis];
+            const float* oIn = offsetIn[axis];
+            int32_t* c = cell[axis];
+            float* o = offset[axis];
+            StoredFloat* v = vel[axis];
+            int32_t frame = position.frame[axis];
+            float lo = (minB[axis] - frameOrigin[axis]) + radius, hi = (maxB[axis] - frameOrigin[axis]) - radius;
+            for (size_t i = begin; i < end; i++) {
+                c[i] = cIn[i];
+                float base = static_cast<float>(c[i] - frame) * cs;
+                float off = oIn[i] + dt * v[i];
+                float p = base + off;
+                if (p < lo) {
+                    off = lo - base;
+                    float relVel = v[i] - wallVelMin[axis] / restDensity;
+                    v[i] = wallVelMin[axis] - relVel * bounce;
+                } else if (p > hi) {
+                    off = hi - base;
+                    float relVel = v[i] - wallVelMax[axis] / restDensity;
+                    v[i] = wallVelMax[axis] - relVel * bounce;
+                }
+                wrapCellOffset(c[i], off, cs);
+                o[i] = off;
             }
         }
-    }
+    });
+    particles.swapGenerations();
+    stepsSinceReorder++;
+    reorderTravel += *std::max_element(threadFastest, threadFastest + workers.size()) * dt;
 }
 
-GridCoord SPHSolver::getCellCord(const glm::vec3& position) const {
-    GridCoord cell;
-    cell.x = static_cast<int>(std::floor(position.x / h));
-    cell.y = static_cast<int>(std::floor(position.y / h));
-    cell.z = static_cast<int>(std::floor(position.z / h));
-    return cell;
+GridCoord SPHSolver::predictedCell(size_t i) const {
+    // the stored cell plus one where the step moved the offset across a face, about a third
+    // faster than the floor of the predicted position over the cell size (bench binning).
+    // a step of more than a cell takes the floor
+    const CellPositionArray& pos = particles.position;
+    const float cs = pos.cellSize;
+    auto axis = [&](int32_t cell, float offset, StoredFloat vel, float predicted, int32_t frame) {
+        float moved = offset + predictDt * static_cast<float>(vel);
+        if (moved >= -cs && moved < 2.0f * cs) return cell + (moved >= cs) - (moved < 0.0f);
+        return static_cast<int>(std::floor(predicted / cs)) + frame;
+    };
+    return {axis(pos.cx[i], pos.offset.x[i], particles.velocity.x[i], particles.predicted.x[i], pos.frame[0]),
+            axis(pos.cy[i], pos.offset.y[i], particles.velocity.y[i], particles.predicted.y[i], pos.frame[1]),
+            axis(pos.cz[i], pos.offset.z[i], particles.velocity.z[i], particles.predicted.z[i], pos.frame[2])};
 }
 
-std::vector<uint32_t> SPHSolver::getNeighbours(uint32_t idx) const {
-    std::vector<uint32_t> result;
-    GridCoord cell = getCellCord(particles[idx].position);
-    for (int dx = -1; dx <= 1; ++dx) {
-        for (int dy = -1; dy <= 1; ++dy) {
-            for (int dz = -1; dz <= 1; ++dz) {
-                GridCoord nc = {cell.x + dx, cell.y + dy, cell.z + dz};
-                auto it = grid.find(nc);
-                if (it != grid.end()) result.insert(result.end(), it->second.begin(), it->second.end());
-            }
-        }
-    }
-    return result;
+GridCoord SPHSolver::getCellCord(size_t i) const {
+    // clamping keeps particles that left the box inside the grid, it only ever brings two
+    // cells closer together so a pair the stencil covers unclamped is still covered
+    GridCoord cell = predictedCell(i);
+    cell.x = std::clamp(cell.x - gridOrigin.x, 0, gridDims.x - 1);
+    cell.y = std::clamp(cell.y - gridOrigin.y, 0, gridDims.y - 1);
+    cell.z = std::clamp(cell.z - gridOrigin.z, 0, gridDims.z - 1);
+    return cell;
 }
 
 float SPHSolver::poly6_kernel(float r2) const {
@@ -155,14 +1311,11 @@ void SPHSolver::spawnParticles() {
                 Particle p;
                 p.position = glm::vec3(x, y, z);
                 p.velocity = glm::vec3(0.0f);
-                particles.push_back(p);
+                addParticle(p);
             }
         }
     }
-    predictedPositions.resize(particles.size(), glm::vec3(0.0f));
-    densities.resize(particles.size(), restDensity);
-    pressures.resize(particles.size(), 0.0f);
-    forces.resize(particles.size(), glm::vec3(0.0f));
+    reorderPending = true;
 }
 
 void SPHSolver::spawnRandom() {
@@ -176,19 +1329,77 @@ void SPHSolver::spawnRandom() {
         Particle p;
         p.position = glm::vec3(disX(gen), disY(gen), disZ(gen));
         p.velocity = glm::vec3(0.0f);
-        particles.push_back(p);
+        addParticle(p);
     }
+    reorderPending = true;
+}
 
-    predictedPositions.resize(particles.size(), glm::vec3(0.0f));
-    densities.resize(particles.size(), restDensity);
-    pressures.resize(particles.size(), 0.0f);
-    forces.resize(particles.size(), glm::vec3(0.0f));
+void SPHSolver::removeRandom() {
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    for (size_t i = 0; i < 100 && getLiveCount() > 0; ++i) {
+        std::uniform_int_distribution<uint32_t> dis(0, static_cast<uint32_t>(particleSlots.size() - 1));
+        uint32_t id = dis(gen);
+        while (!isAlive(id)) id = dis(gen);
+        removeParticle(id);
+    }
+}
+
+void SPHSolver::syncParticleArrays() {
+    // new particles get free or new ids and are sorted into place on the next step
+    for (size_t i = particleIds.size(); i < particles.size(); ++i) {
+        particles.density[i] = restDensity;
+        uint32_t id = static_cast<uint32_t>(particleSlots.size());
+        if (!freeIds.empty()) {
+            id = freeIds.back();
+            freeIds.pop_back();
+            particleSlots[id] = static_cast<uint32_t>(i);
+        } else {
+            particleSlots.push_back(static_cast<uint32_t>(i));
+        }
+        particleIds.push_back(id);
+    }
+    reorderPending = true;
+    gridComparable = false;
+}
+
+const std::vector<Particle>& SPHSolver::getParticleView() {
+    fillParticleView(particleView);
+    return particleView;
+}
+
+void SPHSolver::fillParticleView(std::vector<Particle>& out) {
+    ScratchArena& arena = scratchArenas[0];
+    ScratchScope scope(arena);
+    size_t n = particles.size();
+    float* x = arena.allocate<float>(n);
+    float* y = arena.allocate<float>(n);
+    float* z = arena.allocate<float>(n);
+    particles.position.decode(n, x, y, z, false);
+    out.clear();
+    for (size_t i = 0; i < n; ++i) {
+        if (particles.alive[i]) out.push_back({glm::vec3(x[i], y[i], z[i]), particles.velocity.get(i)});
+    }
 }
 
 void SPHSolver::reset() {
     particles.clear();
-    densities.clear();
-    pressures.clear();
-    forces.clear();
-    grid.clear();
+    particleView.clear();
+    cellStart.clear();
+    cellCount.clear();
+    sortedIndices.clear();
+    particleCell.clear();
+    gridComparable = false;
+    hashCellKeys.clear();
+    hashTable.clear();
+    hashNeighbourCells.clear();
+    verletOffsets.clear();
+    verletNeighbours.clear();
+    verletBase.clear();
+    verletPacked.clear();
+    verletBuildPositions.clear();
+    particleIds.clear();
+    particleSlots.clear();
+    freeSlots.clear();
+    freeIds.clear();
 }
\ No newline at end of file
@@ -9,13 +9,16 @@
 #include <array>
 #include <algorithm>
 #include <unordered_map>
+#include <cstdint>
+#include <memory>
 // accumulate
 #include <numeric>
 
-struct Particle{
-    glm::vec3 position;
-    glm::vec3 velocity;
-};
+#include "memoryReport.hpp"
+#include "particleStore.hpp"
+#include "scratchArena.hpp"
+#include "stencil.hpp"
+#include "threadPool.hpp"
 
 struct GridCoord {
     int x, y, z;
@@ -24,14 +27,100 @@ struct GridCoord {
     }
 };
 
+// cell coordinates are packed 21 bits per axis (x in the low bits) around a bias,
+// so sorting keys sorts cells by z, then y, then x like the dense grid index
+constexpr int CELL_KEY_BITS = 21;
+constexpr int CELL_KEY_BIAS = 1 << (CELL_KEY_BITS - 1);
+
+inline uint64_t packCellKey(const GridCoord& coord) {
+    const uint64_t mask = (1ull << CELL_KEY_BITS) - 1;
+    return (static_cast<uint64_t>(coord.z + CELL_KEY_BIAS) & mask) << (2 * CELL_KEY_BITS) |
+           (static_cast<uint64_t>(coord.y + CELL_KEY_BIAS) & mask) << CELL_KEY_BITS |
+           (static_cast<uint64_t>(coord.x + CELL_KEY_BIAS) & mask);
+}
+
+// murmur3 finalizer, every input bit affects every output bit so neighbouring and
+// negative coordinates spread over the whole table
+inline uint64_t mixCellKey(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ull;
+    key ^= key >> 33;
+    return key;
+}
+
 struct GridCoordHash {
     std::size_t operator()(const GridCoord& coord) const {
-        return (std::hash<int>()(coord.x) ^ 
-                (std::hash<int>()(coord.y) << 1)) >> 1 ^ 
-                (std::hash<int>()(coord.z) << 1);
+        return static_cast<std::size_t>(mixCellKey(packCellKey(coord)));
     }
 };
 
+enum class NeighbourSearch {
+    DenseGrid,   // flat array over the box, particles outside are clamped to the border cells
+    CompactHash, // occupied cells only, in an open addressed table, for unbounded domains
+};
+
+struct GridStats {
+    float changedFraction = 0.0f; // particles that changed cell in the last build
+    uint64_t builds = 0;
+};
+
+struct VerletStats {
+    uint64_t steps = 0;
+    uint64_t rebuilds = 0;
+    uint32_t stepsSinceRebuild = 0;
+    size_t listEntries = 0;        // candidates every neighbour pass walks
+    size_t pairsInRange = 0;       // entries that were inside h when the lists were built
+    size_t listBytes = 0;          // bytes the lists use, offsets included
+    size_t wideLists = 0;          // compressed lists that did not fit 16 bit offsets
+    float maxDisplacement = 0.0f;  // largest move since the last build
+};
+
+struct PairCacheStats {
+    size_t pairs = 0;              // pairs recorded by the last density pass
+    size_t bytes = 0;              // memory held by the cache
+    uint32_t cachedParticles = 0;  // particles whose pairs fit, the force pass searches for the rest
+};
+
+struct TileStats {
+    size_t tiles = 0;              // tiles with particles in the last pass
+    size_t gatheredParticles = 0;  // copied into tiles by the last density and force pass, halos included
+    size_t gatheredBytes = 0;      // bytes those copies read from the particle arrays
+    size_t largestTileBytes = 0;   // biggest single tile copy of the last pass, with its cell table
+};
+
+// a block of dense grid cells and the halo the stencil reaches around it, with the particles
+// of the halo box copied next to each other in cell order. halo cells are numbered x fastest,
+// cellStart has one entry more than there are halo cells
+struct GridTile {
+    GridCoord begin, end;          // owned cells
+    GridCoord haloBegin, haloDims;
+    uint32_t count = 0;
+    uint32_t* cellStart = nullptr;
+    uint32_t* index = nullptr;     // slot of every copied particle
+    float* x = nullptr;
+    float* y = nullptr;
+    float* z = nullptr;
+    // force pass only
+    float* vx = nullptr;
+    float* vy = nullptr;
+    float* vz = nullptr;
+    float* density = nullptr;
+    float* pressure = nullptr;
+
+    uint32_t localCell(int cx, int cy, int cz) const {
+        return static_cast<uint32_t>((cx - haloBegin.x) + haloDims.x * ((cy - haloBegin.y) + haloDims.y * (cz - haloBegin.z)));
+    }
+};
+
+// an in-range pair as seen from particle i, r_ij = x_i - x_j
+struct CachedPair {
+    uint32_t j;
+    float rlen;
+    glm::vec3 r_ij;
+};
+
 class SPHSolver {
 public:
 
@@ -41,12 +130,9 @@ public:
     glm::vec3 prevBoxSize = boxSize;
     float bounce = 0.5f;
 
-    std::unordered_map<GridCoord, std::vector<size_t>, GridCoordHash> grid;
-    std::vector<Particle> particles;
-    std::vector<glm::vec3> predictedPositions;
-    std::vector<float> densities;
-    std::vector<float> pressures;
-    std::vector<glm::vec3> forces;
+    // position, velocity, predicted position, force, density and pressure as separate
+    // aligned arrays. getParticleView() gives the positions and velocities as Particle structs
+    ParticleStore particles;
 
     float radius = 0.05f;
     float h = 2.0f * radius; 
@@ -59,32 +145,431 @@ public:
     float epsilon = 1e-3f; 
     float max_speed = 10.0f; 
 
+    // dense grid of cells of size cellSize covering the box (plus one cell of margin),
+    // built every step with a counting sort over the predicted positions. cells are the search
+    // radius divided by cellsPerH, finer cells test fewer candidates but visit more cells
+    GridCoord gridOrigin = {0, 0, 0}; // in position cells
+    GridCoord gridDims = {0, 0, 0};
+    std::vector<uint32_t> cellStart;
+    std::vector<uint32_t> cellCount;
+    std::vector<uint32_t> sortedIndices;
+    std::vector<uint32_t> particleCell;
+    float cellSize = h;
+    int cellsPerH = 1;
+    const GridStencil* stencil = &gridStencil(1);
+
+    GridStats gridStats;
+
+    // compact hashing (Ihmsen et al.): particles sorted by cell key, one entry per occupied
+    // cell (cellStart/cellCount above are indexed by occupied cell), an open addressed table
+    // of about twice the occupied cells and the stencil cells around each cell cached
+    NeighbourSearch neighbourSearch = NeighbourSearch::DenseGrid;
+    std::vector<uint64_t> hashCellKeys;
+    std::vector<uint32_t> hashTable;
+    std::vector<uint32_t> hashNeighbourCells;
+
+    // verlet neighbour lists (CSR) built with radius h + verletSkin, reused until some
+    // particle moved more than verletSkin / 2 since the last build
+    bool useVerletLists = false;
+    float verletSkin = 0.2f * h;
+    VerletStats verletStats;
+    std::vector<uint32_t> verletOffsets;
+    std::vector<uint32_t> verletNeighbours;
+    Vec3Array verletBuildPositions;
+
+    // compressed verlet lists: each neighbour is a 16 bit offset from the smallest index in
+    // its list (verletBase), so verletOffsets count uint16 words of verletPacked. lists whose
+    // indices span more than 16 bits are flagged with VERLET_WIDE and store every index as
+    // two words, low half first. pays off once particles are spatially sorted
+    bool compressVerletLists = false;
+    std::vector<uint32_t> verletBase;
+    std::vector<uint16_t> verletPacked;
+    static constexpr uint32_t VERLET_WIDE = 0x80000000u;
+
+    // particles are sorted by the morton code of their cell every reorderInterval steps
+    // (0 picks the interval from how fast the fluid moves, -1 turns it off).
+    // particleIds[slot] is the id a particle got at spawn, particleSlots[id] where it is now
+    int reorderInterval = 0;
+    uint64_t reorderCount = 0;
+    std::vector<uint32_t> particleIds;
+    std::vector<uint32_t> particleSlots;
+
+    // removed particles leave a dead slot (particleIds[slot] == NO_ID) and give back their id.
+    // addParticle() reuses both, and the slots are compacted away once more than
+    // compactionThreshold of them are dead
+    float compactionThreshold = 0.25f;
+    uint64_t compactionCount = 0;
+
+    // evaluate every pair once over a half stencil and scatter it to both particles. always
+    // searches the grid (verlet lists are ignored). with numThreads > 1 every thread owns a
+    // range of cells and accumulates into its own buffers, summed afterwards, so no two
+    // threads write the same particle
+    bool useSymmetricPairs = false;
+
+    // threads every stage of a step runs on, the calling thread included. the per particle
+    // passes give the same result on any number of threads, 1 runs everything inline.
+    // still serial: the reorder's sort, the compaction's live scan, the hash grid's key fill,
+    // radix scatters, run detection, table fill and neighbour cell cache, applyNudges (only
+    // when particles coincide), the pair cache fill and the verlet lists
+    int numThreads = 1;
+
+    // the density and force passes go over blocks of dense grid cells instead of ranges of
+    // particles. a block weighs its particles times the candidates they test, the threads
+    // start with runs of blocks of equal weight and steal from each other once theirs is
+    // done, which keeps them busy when the fluid piles up in one part of the box. dense grid
+    // without verlet lists only, the results are the same as without
+    bool useWorkStealing = false;
+
+    // the density pass records every in-range pair (CSR by particle) and the force pass
+    // streams them instead of searching again. the cache never grows past pairCacheBudget
+    // bytes, particles whose pairs did not fit fall back to the search.
+    // not used by the symmetric passes
+    bool usePairCache = false;
+    size_t pairCacheBudget = 64u << 20;
+    PairCacheStats pairCacheStats;
+
+    // tiled passes: the dense grid is cut into blocks of tileCells^3 cells, each block copies
+    // its particles and the halo around it into a GridTile, runs the kernels on the copy and
+    // writes back its own particles only. neighbours are then read from a few hundred KiB
+    // that stay in cache instead of from all over the particle arrays. bench tiles, 300k
+    // particles on one thread: 8^3 cell tiles of about 290 KiB (2 MiB L2) run the passes
+    // about 6% faster than untiled. that store of 30 MiB still fit the 300 MiB LLC, so what
+    // tiles save once the arrays outgrow the LLC is not measured. dense grid only, ignores
+    // verlet lists and the pair cache, the symmetric passes take precedence. with
+    // numThreads > 1 the threads take tiles as they finish the previous one
+    bool useTiles = false;
+    int tileCells = 8;
+    TileStats tileStats;
+
     SPHSolver() {}
     ~SPHSolver() {}
 
     void update(float dt);
     void spawnParticles();
     void spawnRandom();
+    void removeRandom();
     void reset();
+    // sizes the per-particle arrays and hands out ids after pushing into particles
+    void syncParticleArrays();
+
+    // room for n particles in the arrays and the id tables, so emitting up to n reallocates
+    // nothing. past it the particle arrays grow by half and are copied
+    void reserveParticles(size_t n);
+    // emits one particle into a free slot (or a new one at the end) and returns its id
+    uint32_t addParticle(const Particle& p);
+    void removeParticle(uint32_t id);
+    bool isAlive(uint32_t id) const { return id < particleSlots.size() && particleSlots[id] != NO_SLOT; }
+    size_t getLiveCount() const { return particles.size() - freeSlots.size(); }
+    float getFragmentation() const { return particles.empty() ? 0.0f : static_cast<float>(freeSlots.size()) / particles.size(); }
+    void compactParticles();
     void stop() {
-        for (uint32_t i = 0; i < particles.size(); ++i) {
-            particles[i].velocity = glm::vec3(0.0f);
-        }
+        std::fill(particles.velocity.x.begin(), particles.velocity.x.end(), 0.0f);
+        std::fill(particles.velocity.y.begin(), particles.velocity.y.end(), 0.0f);
+        std::fill(particles.velocity.z.begin(), particles.velocity.z.end(), 0.0f);
     }
 
+    Particle getParticleById(uint32_t id) const { return particles.get(particleSlots[id]); }
+
     float getAverageDensity() const {
-        return std::accumulate(densities.begin(), densities.end(), 0.0f) / densities.size();
+        float sum = 0.0f;
+        for (size_t i = 0; i < particles.size(); ++i) sum += particles.alive[i] ? static_cast<float>(particles.density[i]) : 0.0f;
+        return sum / getLiveCount();
     }
 
-private:
+    // positions and velocities interleaved like the renderer uploads them, gathered again on
+    // every call into a buffer that keeps its capacity
+    const std::vector<Particle>& getParticleView();
+    // the same gathered into out, for a copy that outlives the next step
+    void fillParticleView(std::vector<Particle>& out);
+
+    // pipeline stages, public so the benchmarks can time them one by one. what each one
+    // reads and writes, per particle i unless noted:
+    //   predictePositions  position, velocity           -> predicted[i]
+    //   builGrid           predicted                    -> grid
+    //   density/pressure   predicted, grid              -> density[i], pressure[i]
+    //   forces             predicted, velocity, density,
+    //                      pressure, grid               -> force[i], coincident pairs (per worker)
+    //   integrate          position, velocity, force    -> nextPosition[i], nextVelocity[i]
+    //   applyNudges        coincident pairs             -> position (serial)
+    // no iteration writes anything another one reads, so the per particle passes give the same
+    // bits on any number of threads. the symmetric passes sum per thread buffers and agree
+    // with them to within PARALLEL_TOLERANCE
     void predictePositions(float dt);
     void builGrid();
     void computeDensityPressure();
     void computeForces();
     void integrate(float dt);
+    // pushes apart the coincident pairs the last force pass found
+    void applyNudges();
+    void buildVerletLists();
+    bool verletNeedsRebuild();
+    void reorderParticles();
+    bool needsReorder() const;
+    void computeDensityPressureSymmetric();
+    void computeForcesSymmetric();
+    void computeDensityPressureTiled();
+    void computeForcesTiled();
+
+    // times a few steps of a copy of the solver for every cellsPerH and keeps the fastest
+    int calibrateCellResolution(float dt, int steps = 5);
 
-    GridCoord getCellCord(const glm::vec3& position) const;
-    std::vector<uint32_t> getNeighbours(uint32_t idx) const;
+    size_t getCellCount() const { return cellCount.size(); }
+    size_t getSearchMemory() const;
+    // most step scratch memory ever in use at once, summed over the per thread arenas
+    size_t getScratchHighWater() const;
+    size_t getScratchCapacity() const;
+    // every array the solver owns, grouped by what it is for. the step scratch reports its peak
+    // as bytes in use. the second form refills report, which keeps its entries' storage
+    MemoryReport getMemoryReport() const {
+        MemoryReport report;
+        getMemoryReport(report);
+        return report;
+    }
+    void getMemoryReport(MemoryReport& report) const;
+    // busy and idle time of every thread in the balanced passes of the last step
+    const std::vector<WorkerStats>& getWorkerStats() { return pool().workerStats(); }
+    // runs the stages on pool instead of a pool of the solver's own, numThreads still sets
+    // its size. copies of the solver share the pool. a pool runs one job at a time and is not
+    // locked, so solvers sharing one must be stepped from one thread (or never at once)
+    void setThreadPool(std::shared_ptr<ThreadPool> pool) { threadPool = std::move(pool); }
+    // sets the page policy and moves the particle arrays to pages allocated under it. with
+    // numaFirstTouch every pool worker first touches the pages under its slice of the particle
+    // capacity, and the passes over particles hand each worker that same slice instead of
+    // dynamic chunks, so a worker's particles sit on its node. the workers are not pinned, the
+    // cell block passes (tiles, work stealing) ignore it, and a change of numThreads moves the
+    // arrays again at the next step
+    void setPagePolicy(HugePages hugePages, bool numaFirstTouch);
+    bool getNumaFirstTouch() const { return numaFirstTouch; }
+
+    // largest difference between a threaded and a serial density or force, relative to the
+    // largest value of the pass. only the symmetric passes differ at all, they add the per
+    // thread sums in another order
+    static constexpr float PARALLEL_TOLERANCE = 1e-5f;
+
+    static constexpr uint32_t NO_CELL = 0xffffffffu;
+    static constexpr uint32_t NO_ID = 0xffffffffu;
+    static constexpr uint32_t NO_SLOT = 0xffffffffu;
+    // the frame is moved once the box is this many cells away from it
+    static constexpr int32_t FRAME_DRIFT_CELLS = 1024;
+
+    // calls f(j) for every neighbour candidate of particle idx (idx included), callers still
+    // have to check the distance. never allocates
+    template <typename F>
+    void forEachNeighbour(uint32_t idx, F&& f) const {
+        if (useVerletLists) {
+            if (verletBuildCompressed) {
+                forEachPackedNeighbour(idx, f);
+                return;
+            }
+            for (uint32_t k = verletOffsets[idx]; k < verletOffsets[idx + 1]; ++k) f(verletNeighbours[k]);
+            return;
+        }
+        forEachGridNeighbour(idx, f);
+    }
+
+    // decodes a compressed verlet list in blocks, the decode loop has no calls in it so
+    // it vectorizes to a widen and add
+    template <typename F>
+    void forEachPackedNeighbour(uint32_t idx, F&& f) const {
+        const uint32_t begin = verletOffsets[idx], end = verletOffsets[idx + 1];
+        const uint32_t base = verletBase[idx];
+        const uint16_t* packed = verletPacked.data();
+        if (base & VERLET_WIDE) {
+            for (uint32_t k = begin; k < end; k += 2) f(packed[k] | static_cast<uint32_t>(packed[k + 1]) << 16);
+            return;
+        }
+        constexpr uint32_t BLOCK = 64;
+        uint32_t decoded[BLOCK];
+        for (uint32_t k = begin; k < end; k += BLOCK) {
+            const uint32_t count = std::min(BLOCK, end - k);
+            for (uint32_t b = 0; b < count; ++b) decoded[b] = base + packed[k + b];
+            for (uint32_t b = 0; b < count; ++b) f(decoded[b]);
+        }
+    }
+
+    // calls f(j) for every particle in the stencil cells around particle idx, nothing for a
+    // dead slot
+    template <typename F>
+    void forEachGridNeighbour(uint32_t idx, F&& f) const {
+        uint32_t c = particleCell[idx];
+        if (c == NO_CELL) return;
+        if (neighbourSearch == NeighbourSearch::CompactHash) {
+            const int stride = stencil->cellCount;
+            const uint32_t* cells = &hashNeighbourCells[static_cast<size_t>(stride) * c];
+            for (int k = 0; k < stride; ++k) {
+                if (cells[k] == NO_CELL) continue;
+                uint32_t end = cellStart[cells[k]] + cellCount[cells[k]];
+                for (uint32_t b = cellStart[cells[k]]; b < end; ++b) f(sortedIndices[b]);
+            }
+            return;
+        }
+        int cx = static_cast<int>(c % gridDims.x);
+        int cy = static_cast<int>((c / gridDims.x) % gridDims.y);
+        int cz = static_cast<int>(c / (gridDims.x * gridDims.y));
+        for (int r = 0; r < stencil->rowCount; ++r) {
+            const StencilRow& row = stencil->rows[r];
+            int y = cy + row.dy, z = cz + row.dz;
+            if (y < 0 || y >= gridDims.y || z < 0 || z >= gridDims.z) continue;
+            // the cells of a row are consecutive so their particles are one range
+            uint32_t first = getCellIndex({std::max(cx + row.dxMin, 0), y, z});
+            uint32_t last = getCellIndex({std::min(cx + row.dxMax, gridDims.x - 1), y, z});
+            uint32_t end = cellStart[last] + cellCount[last];
+            for (uint32_t k = cellStart[first]; k < end; ++k) f(sortedIndices[k]);
+        }
+    }
+
+    // calls f(i, j) once for every pair of distinct particles where i lives in a cell of
+    // [cellBegin, cellEnd) and j in the same cell or one of the stencil cells after it
+    template <typename F>
+    void forEachPairInCells(uint32_t cellBegin, uint32_t cellEnd, F&& f) const {
+        for (uint32_t c = cellBegin; c < cellEnd; ++c) {
+            uint32_t count = cellCount[c];
+            if (count == 0) continue;
+            uint32_t begin = cellStart[c], end = begin + count;
+
+            // same cell, j after i
+            for (uint32_t a = begin; a < end; ++a) {
+                for (uint32_t b = a + 1; b < end; ++b) f(sortedIndices[a], sortedIndices[b]);
+            }
+
+            if (neighbourSearch == NeighbourSearch::CompactHash) {
+                // the cached stencil is ordered by z, y, x so the forward cells come after the centre
+                const int stride = stencil->cellCount;
+                const uint32_t* cells = &hashNeighbourCells[static_cast<size_t>(stride) * c];
+                for (int k = stride / 2 + 1; k < stride; ++k) {
+                    if (cells[k] == NO_CELL) continue;
+                    uint32_t nEnd = cellStart[cells[k]] + cellCount[cells[k]];
+                    for (uint32_t a = begin; a < end; ++a) {
+                        uint32_t i = sortedIndices[a];
+                        for (uint32_t b = cellStart[cells[k]]; b < nEnd; ++b) f(i, sortedIndices[b]);
+                    }
+                }
+                continue;
+            }
+
+            int cx = static_cast<int>(c % gridDims.x);
+            int cy = static_cast<int>((c / gridDims.x) % gridDims.y);
+            int cz = static_cast<int>(c / (gridDims.x * gridDims.y));
+            auto visitRow = [&](int x0, int x1, int y, int z) {
+                if (y < 0 || y >= gridDims.y || z >= gridDims.z) return;
+                x0 = std::max(x0, 0);
+                x1 = std::min(x1, gridDims.x - 1);
+                if (x0 > x1) return;
+                uint32_t first = getCellIndex({x0, y, z});
+                uint32_t last = getCellIndex({x1, y, z});
+                uint32_t nEnd = cellStart[last] + cellCount[last];
+                for (uint32_t a = begin; a < end; ++a) {
+                    uint32_t i = sortedIndices[a];
+                    for (uint32_t b = cellStart[first]; b < nEnd; ++b) f(i, sortedIndices[b]);
+                }
+            };
+            // forward cells are the rest of this row after x and every row after it
+            int centre = stencil->rowCount / 2;
+            const StencilRow& own = stencil->rows[centre];
+            visitRow(cx + 1, cx + own.dxMax, cy, cz);
+            for (int r = centre + 1; r < stencil->rowCount; ++r) {
+                const StencilRow& row = stencil->rows[r];
+                visitRow(cx + row.dxMin, cx + row.dxMax, cy + row.dy, cz + row.dz);
+            }
+        }
+    }
+
+private:
+    // per thread accumulation buffers of the symmetric passes
+    std::vector<float*> threadDensities;
+    std::vector<glm::vec3*> threadForces;
+    // coincident pairs each force pass worker found, applyNudges() separates them
+    std::vector<std::vector<std::pair<uint32_t, uint32_t>>> threadNudges;
+    std::vector<uint32_t> threadCellBegin;
+
+    void splitCellsByParticles(int threads);
+
+    std::shared_ptr<ThreadPool> threadPool;
+    // the pool, made on first use and sized to numThreads
+    ThreadPool& pool();
+
+    // blocks of cells each thread starts with when balancing
+    static constexpr size_t BLOCKS_PER_WORKER = 32;
+    bool usesWorkStealing() const {
+        return useWorkStealing && !useSymmetricPairs && !useVerletLists && neighbourSearch == NeighbourSearch::DenseGrid;
+    }
+    // particles the stencil around cell c holds
+    uint32_t cellCandidates(uint32_t c) const;
+    // runs fn(i, t) for every particle in the dense grid on the stealing scheduler, t is the
+    // thread
+    template <typename F>
+    void forEachParticleBalanced(F&& fn);
+    // runs fn(begin, end, t) over [0, n), items of `unit` particles: dynamic chunks, or with
+    // numaFirstTouch the slice of the capacity worker t touched first
+    template <typename F>
+    void forEachParticleRange(size_t n, size_t unit, F&& fn);
+    bool numaFirstTouch = false;
+    // pool size the particle arrays were first touched with
+    int touchedThreads = 0;
+
+    bool usesTiles() const { return useTiles && !useSymmetricPairs && neighbourSearch == NeighbourSearch::DenseGrid; }
+    // copies the particles of the halo box of tile into arena, with velocity, density and
+    // pressure when withState
+    void gatherTile(GridTile& tile, ScratchArena& arena, bool withState) const;
+    // runs pass(tile, t) on every tile holding particles, t is the thread, and fills tileStats
+    template <typename F>
+    void forEachTile(bool withState, F&& pass);
+
+    std::vector<uint32_t> pairOffsets;
+    std::vector<CachedPair> pairCache;
+
+    // temporaries of a step come from here, reset at the start of update(). arena t belongs
+    // to worker t of the symmetric passes, arena 0 is also the one of the calling thread
+    std::vector<ScratchArena> scratchArenas = std::vector<ScratchArena>(1);
+    std::vector<ScratchArena::Marker> threadMarks;
+
+    void resetScratch();
+
+    std::vector<uint32_t> freeSlots;
+    std::vector<uint32_t> freeIds;
+
+    // moves the particle in slot order[k] to slot k and keeps the first `keep` slots, the
+    // ones dropped must be dead
+    void permuteParticles(const uint32_t* order, size_t keep);
+    // drops the cached grid and neighbour lists, they index slots
+    void invalidateNeighbours();
+    // marks every worker arena before a threaded pass and rewinds them after it
+    void openThreadScratch(int threads);
+    void closeThreadScratch();
+
+    // dense grid layout of the last build, particleCell is only compared against a grid of the same
+    bool gridComparable = false;
+    float gridBuildCellSize = 0.0f;
+
+    void buildDenseGrid();
+    // counting sort of the particles into the dense cells, threaded for large counts as long
+    // as the per thread histograms stay under SORT_HISTOGRAM_BYTES
+    void sortDenseCells(const uint32_t* newCells, size_t numCells);
+    void buildHashGrid();
+    uint32_t findHashCell(uint64_t key) const;
+
+    // parameters the verlet lists were built with, they are rebuilt if any changes
+    float verletBuildH = 0.0f;
+    float verletBuildSkin = 0.0f;
+    bool verletBuildCompressed = false;
+    std::vector<uint32_t> verletRow;
+
+    // auto reorder: steps and worst case distance travelled since the last sort
+    uint32_t stepsSinceReorder = 0;
+    float reorderTravel = 0.0f;
+    bool reorderPending = false;
+    std::vector<Particle> particleView;
+    // the step the predicted positions were made with
+    float predictDt = 0.0f;
+
+    // cell of the predicted position of particle i, in position cells / in the dense grid
+    GridCoord predictedCell(size_t i) const;
+    GridCoord getCellCord(size_t i) const;
+    // keeps the position encoding on grid cells and the frame near the box
+    void updatePositionFrame();
+    uint32_t getCellIndex(const GridCoord& cell) const {
+        return static_cast<uint32_t>(cell.x + gridDims.x * (cell.y + gridDims.y * cell.z));
+    }
     
     // Kernel functions
     float poly6_kernel(float r2) const;
@@ -0,0 +1,108 @@
+#ifndef STENCIL_HPP
+#define STENCIL_HPP
+
+#include <algorithm>
+#include <array>
+
+// Neighbour stencils for grids whose cells are 1/R of the search radius. A cell of the
+// (2R+1)^3 cube is kept only if its closest point can be nearer than the radius, so finer
+// cells hug the kernel sphere more tightly. All tables are generated at compile time.
+
+constexpr int MAX_CELLS_PER_H = 3;
+
+struct StencilCell {
+    int dx, dy, dz;
+};
+
+// the consecutive cells dxMin..dxMax of row (dy, dz)
+struct StencilRow {
+    int dy, dz, dxMin, dxMax;
+};
+
+struct GridStencil {
+    int reach;                // R, cells per search radius
+    const StencilCell* cells; // ordered by dz, dy, dx so the centre is cells[cellCount / 2]
+    int cellCount;
+    const StencilRow* rows;   // same order
+    int rowCount;
+};
+
+namespace stencil_detail {
+
+// empty cells between two cells d apart along one axis
+constexpr int gap(int d) {
+    return d > 0 ? d - 1 : (d < 0 ? -d - 1 : 0);
+}
+
+constexpr bool keeps(int reach, int dx, int dy, int dz) {
+    return gap(dx) * gap(dx) + gap(dy) * gap(dy) + gap(dz) * gap(dz) < reach * reach;
+}
+
+template <int R>
+constexpr int cellCount() {
+    int count = 0;
+    for (int dz = -R; dz <= R; ++dz)
+        for (int dy = -R; dy <= R; ++dy)
+            for (int dx = -R; dx <= R; ++dx)
+                if (keeps(R, dx, dy, dz)) count++;
+    return count;
+}
+
+template <int R>
+constexpr int rowCount() {
+    int count = 0;
+    for (int dz = -R; dz <= R; ++dz)
+        for (int dy = -R; dy <= R; ++dy)
+            if (keeps(R, 0, dy, dz)) count++;
+    return count;
+}
+
+template <int R>
+constexpr std::array<StencilCell, cellCount<R>()> makeCells() {
+    std::array<StencilCell, cellCount<R>()> cells{};
+    int k = 0;
+    for (int dz = -R; dz <= R; ++dz)
+        for (int dy = -R; dy <= R; ++dy)
+            for (int dx = -R; dx <= R; ++dx)
+                if (keeps(R, dx, dy, dz)) cells[k++] = {dx, dy, dz};
+    return cells;
+}
+
+// the kept cells of a row are symmetric around dx = 0 and contiguous
+template <int R>
+constexpr std::array<StencilRow, rowCount<R>()> makeRows() {
+    std::array<StencilRow, rowCount<R>()> rows{};
+    int k = 0;
+    for (int dz = -R; dz <= R; ++dz) {
+        for (int dy = -R; dy <= R; ++dy) {
+            if (!keeps(R, 0, dy, dz)) continue;
+            int dx = 0;
+            while (dx < R && keeps(R, dx + 1, dy, dz)) dx++;
+            rows[k++] = {dy, dz, -dx, dx};
+        }
+    }
+    return rows;
+}
+
+template <int R>
+struct Tables {
+    static constexpr std::array<StencilCell, cellCount<R>()> cells = makeCells<R>();
+    static constexpr std::array<StencilRow, rowCount<R>()> rows = makeRows<R>();
+};
+
+static_assert(cellCount<1>() == 27, "cells of size h need the full 3x3x3 cube");
+
+} // namespace stencil_detail
+
+// stencil for cells of size radius / reach, reach is clamped to [1, MAX_CELLS_PER_H]
+inline const GridStencil& gridStencil(int reach) {
+    using namespace stencil_detail;
+    static const GridStencil stencils[MAX_CELLS_PER_H] = {
+        {1, Tables<1>::cells.data(), cellCount<1>(), Tables<1>::rows.data(), rowCount<1>()},
+        {2, Tables<2>::cells.data(), cellCount<2>(), Tables<2>::rows.data(), rowCount<2>()},
+        {3, Tables<3>::cells.data(), cellCount<3>(), Tables<3>::rows.data(), rowCount<3>()},
+    };
+    return stencils[std::clamp(reach, 1, MAX_CELLS_PER_H) - 1];
+}
+
+#endif // STENCIL_HPP
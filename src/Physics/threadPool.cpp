@@ -0,0 +1,129 @@
+#include "threadPool.hpp"
+
+ThreadPool::ThreadPool(int threads) {
+    resize(threads);
+}
+
+ThreadPool::~ThreadPool() {
+    stopWorkers();
+}
+
+void ThreadPool::resize(int threads) {
+    threads = std::max(threads, 1);
+    if (threads == threadCount) return;
+    stopWorkers();
+    threadCount = threads;
+    queues = std::make_unique<TaskQueue[]>(threads);
+    stats.assign(threads, WorkerStats{});
+    workers.reserve(threads - 1);
+    for (int t = 1; t < threads; ++t) workers.emplace_back(&ThreadPool::workerLoop, this, t, generation);
+}
+
+void ThreadPool::stopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) worker.join();
+    workers.clear();
+    stopping = false;
+    threadCount = 1;
+}
+
+void ThreadPool::dispatch(Job call, void* context) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = call;
+        jobContext = context;
+        busy = threadCount - 1;
+        generation++;
+    }
+    wake.notify_all();
+    call(context, 0);
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&] { return busy == 0; });
+}
+
+void ThreadPool::workerLoop(int t, uint64_t seen) {
+    for (;;) {
+        Job call;
+        void* context;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            call = job;
+            context = jobContext;
+        }
+        call(context, t);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busy == 0) finished.notify_one();
+    }
+}
+
+void ThreadPool::splitTasks(size_t taskCount, const uint64_t* weights) {
+    uint64_t total = 0;
+    for (size_t k = 0; k < taskCount; ++k) total += weights[k];
+    // worker t starts at the first task past t/threadCount of the total weight
+    uint64_t sum = 0;
+    size_t k = 0;
+    for (int t = 0; t < threadCount; ++t) {
+        TaskQueue& queue = queues[t];
+        queue.front = static_cast<uint32_t>(k);
+        uint64_t target = total * (t + 1) / threadCount;
+        while (k < taskCount && (sum < target || t == threadCount - 1)) sum += weights[k++];
+        queue.back = static_cast<uint32_t>(k);
+        queue.busyMs = 0.0;
+        queue.tasks = 0;
+        queue.steals = 0;
+    }
+}
+
+bool ThreadPool::popTask(int t, uint32_t& task) {
+    TaskQueue& queue = queues[t];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.front == queue.back) return false;
+    task = queue.front++;
+    return true;
+}
+
+bool ThreadPool::stealTasks(int t, uint32_t& task) {
+    // the others in turn starting after t, so thieves spread over the victims
+    for (int k = 1; k < threadCount; ++k) {
+        TaskQueue& victim = queues[(t + k) % threadCount];
+        uint32_t front, back;
+        {
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            uint32_t left = victim.back - victim.front;
+            if (left == 0) continue;
+            back = victim.back;
+            victim.back -= (left + 1) / 2;
+            front = victim.back;
+        }
+        // nobody steals from an empty queue, so only this worker touches its own meanwhile
+        TaskQueue& queue = queues[t];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.front = front + 1;
+        queue.back = back;
+        queue.steals++;
+        task = front;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::addPassStats(double wallMs) {
+    for (int t = 0; t < threadCount; ++t) {
+        const TaskQueue& queue = queues[t];
+        stats[t].busyMs += queue.busyMs;
+        stats[t].idleMs += std::max(wallMs - queue.busyMs, 0.0);
+        stats[t].tasks += queue.tasks;
+        stats[t].steals += queue.steals;
+    }
+}
+
+void ThreadPool::resetWorkerStats() {
+    std::fill(stats.begin(), stats.end(), WorkerStats{});
+}
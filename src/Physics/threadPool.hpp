@@ -0,0 +1,137 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// time a worker spent in runStealing() passes since the last resetWorkerStats()
+struct WorkerStats {
+    double busyMs = 0.0; // running tasks
+    double idleMs = 0.0; // waiting for work or for the other workers to finish the pass
+    uint64_t tasks = 0;
+    uint64_t steals = 0;
+};
+
+// workers that stay alive between steps. the calling thread is worker 0 and runs its share
+// too, so a pool of one thread runs everything inline. run() and parallelFor() return once
+// every worker finished, which is the barrier between two stages. a job is passed as a
+// pointer to the caller's lambda, so dispatching one never allocates.
+// only one thread may use a pool at a time: jobs, resize() and the worker stats are not
+// guarded against a second caller
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads = 1);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // starts or stops workers until there are `threads`, the caller included
+    void resize(int threads);
+    int size() const { return threadCount; }
+
+    // runs fn(t) once for every t in [0, size())
+    template <typename F>
+    void run(F&& fn) {
+        if (threadCount == 1) {
+            fn(0);
+            return;
+        }
+        using Fn = std::remove_reference_t<F>;
+        dispatch([](void* context, int t) { (*static_cast<Fn*>(context))(t); }, const_cast<void*>(static_cast<const void*>(&fn)));
+    }
+
+    // splits [begin, end) into chunks of at least grain items that the workers take in turn
+    // and calls fn(chunkBegin, chunkEnd, t) for each, t being the worker
+    template <typename F>
+    void parallelFor(size_t begin, size_t end, size_t grain, F&& fn) {
+        if (begin >= end) return;
+        if (threadCount == 1) {
+            fn(begin, end, 0);
+            return;
+        }
+        // a few chunks per worker so an unlucky one does not hold the others up
+        size_t chunk = std::max<size_t>(std::max<size_t>(grain, 1), (end - begin) / (8 * threadCount));
+        std::atomic<size_t> next{begin};
+        run([&](int t) {
+            for (size_t b = next.fetch_add(chunk); b < end; b = next.fetch_add(chunk)) fn(b, std::min(b + chunk, end), t);
+        });
+    }
+
+    // runs fn(task, t) for every task in [0, taskCount). the tasks start out split into
+    // contiguous runs of about equal total weight, one run per worker. a worker takes tasks
+    // from the front of its run and, once that is empty, steals the back half of the run of
+    // another worker, so a worker that got the expensive tasks is helped by the others
+    template <typename F>
+    void runStealing(size_t taskCount, const uint64_t* weights, F&& fn) {
+        if (taskCount == 0) return;
+        splitTasks(taskCount, weights);
+        auto start = Clock::now();
+        run([&](int t) {
+            TaskQueue& queue = queues[t];
+            uint32_t task;
+            while (popTask(t, task) || stealTasks(t, task)) {
+                auto taskStart = Clock::now();
+                fn(task, t);
+                queue.busyMs += std::chrono::duration<double, std::milli>(Clock::now() - taskStart).count();
+                queue.tasks++;
+            }
+        });
+        addPassStats(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+
+    // per worker, index t is worker t
+    const std::vector<WorkerStats>& workerStats() const { return stats; }
+    void resetWorkerStats();
+
+private:
+    using Job = void (*)(void*, int);
+    using Clock = std::chrono::steady_clock;
+
+    // the tasks [front, back) a worker has left, padded so workers do not share a line
+    struct alignas(64) TaskQueue {
+        std::mutex mutex;
+        uint32_t front = 0;
+        uint32_t back = 0;
+        // of the running pass
+        double busyMs = 0.0;
+        uint64_t tasks = 0;
+        uint64_t steals = 0;
+    };
+
+    int threadCount = 1;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    Job job = nullptr;
+    void* jobContext = nullptr;
+    uint64_t generation = 0;
+    int busy = 0;
+    bool stopping = false;
+
+    std::unique_ptr<TaskQueue[]> queues = std::make_unique<TaskQueue[]>(1);
+    std::vector<WorkerStats> stats = std::vector<WorkerStats>(1);
+
+    void dispatch(Job call, void* context);
+    // seen is the job generation when the worker started, it only runs later ones
+    void workerLoop(int t, uint64_t seen);
+    void stopWorkers();
+
+    void splitTasks(size_t taskCount, const uint64_t* weights);
+    bool popTask(int t, uint32_t& task);
+    // moves the back half of the tasks of another worker into the empty queue of worker t
+    // and takes the first of them
+    bool stealTasks(int t, uint32_t& task);
+    void addPassStats(double wallMs);
+};
+
+#endif // THREAD_POOL_HPP
@@ -0,0 +1,37 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+// one writer and one reader hand values over without waiting on each other. the writer fills
+// back() and publish() swaps it with the middle slot, acquire() swaps the middle slot with the
+// reader's front() if something was published since. each side only ever touches its own
+// slot, so a published value stays as it is until the reader lets go of it, and the reader
+// always gets the latest complete one, skipping any it was too slow for
+template <typename T>
+class TripleBuffer {
+public:
+    T& back() { return slots[backIdx]; }
+    void publish() { backIdx = middle.exchange(backIdx | FRESH, std::memory_order_acq_rel) & INDEX; }
+
+    // true if front() changed
+    bool acquire() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+        frontIdx = middle.exchange(frontIdx, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+    const T& front() const { return slots[frontIdx]; }
+
+private:
+    // the middle slot index, FRESH while the reader has not taken it
+    static constexpr uint8_t INDEX = 3;
+    static constexpr uint8_t FRESH = 4;
+
+    T slots[3];
+    uint8_t backIdx = 0;
+    uint8_t frontIdx = 1;
+    std::atomic<uint8_t> middle{2};
+};
+
+#endif // TRIPLE_BUFFER_HPP
@@ -14,6 +14,10 @@ void Buffer::initInstanced(const void* vertexData, const void* instanceData, con
     indexCount = config.indexCount;
     instancesCount = config.instancesCount;
     this->drawMode = drawMode;
+    vertexBytes = config.sizeOfVertexData;
+    indexBytes = hasEBO ? config.indexCount * sizeof(uint32_t) : 0;
+    instanceBytes = ssboBytes = instancesCount * config.sizeOfInstance;
+    instanceBytesUsed = 0;
     
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
@@ -83,6 +87,7 @@ void Buffer::updateInstanceData(const void* instanceData, size_t instanceSize, s
         return;
     }
     instancesCount = instanceCount;
+    instanceBytesUsed = instanceSize * instanceCount;
     glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
     glBufferSubData(GL_ARRAY_BUFFER, 0, instanceSize * instanceCount, instanceData);
 }
@@ -96,6 +101,9 @@ void Buffer::init(const void* vertexData, const uint32_t* indexData, const VAOCo
     hasEBO = config.useEBO;
     drawMode = config.drawMode;
     indexCount = config.indexCount;
+    vertexBytes = config.sizeOfVertexData;
+    indexBytes = hasEBO ? config.indexCount * sizeof(uint32_t) : 0;
+    instanceBytes = ssboBytes = instanceBytesUsed = 0;
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
     if (config.useEBO) glGenBuffers(1, &EBO);
@@ -144,4 +152,14 @@ void Buffer::cleanup() {
     if (hasEBO) glDeleteBuffers(1, &EBO);
     isInitialized = false;
     hasEBO = false;
+    vertexBytes = indexBytes = instanceBytes = ssboBytes = instanceBytesUsed = 0;
+}
+
+MemoryReport Buffer::getMemoryReport() const {
+    MemoryReport report;
+    if (vertexBytes) report.add("vbo", vertexBytes, vertexBytes);
+    if (indexBytes) report.add("ebo", indexBytes, indexBytes);
+    if (instanceBytes) report.add("instance", instanceBytesUsed, instanceBytes);
+    if (ssboBytes) report.add("ssbo", ssboBytes, ssboBytes);
+    return report;
 }
@@ -4,6 +4,8 @@
 #include <glad/glad.h>
 #include <vector>
 
+#include "memoryReport.hpp"
+
 struct AttributeInfo {
     GLuint index;
     GLint size;
@@ -46,6 +48,12 @@ public:
     bool hasEBO = false;
     bool isInitialized = false;
 
+    // bytes allocated on the GPU per buffer object, and how much of the instance buffers the
+    // last update filled
+    size_t vertexBytes = 0, indexBytes = 0;
+    size_t instanceBytes = 0, ssboBytes = 0;
+    size_t instanceBytesUsed = 0;
+
     Buffer() = default;
     ~Buffer() {};
 
@@ -60,6 +68,10 @@ public:
     void updateInstanceData(const void* instanceData, size_t instanceSize, size_t instanceCount);
     void cleanup();
 
+    size_t getMemoryBytes() const { return vertexBytes + indexBytes + instanceBytes + ssboBytes; }
+    // one entry per buffer object that is allocated
+    MemoryReport getMemoryReport() const;
+
 };
 
 #endif // BUFFER_HPP
\ No newline at end of file
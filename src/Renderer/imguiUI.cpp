@@ -7,12 +7,12 @@ ImguiUI::~ImguiUI() {
     ImGui::DestroyContext();
 }
 
-void ImguiUI::init(GLFWwindow* window, const std::string& glsl_version, SPHSolver* sphSolver) {
+void ImguiUI::init(GLFWwindow* window, const std::string& glsl_version, SimulationThread* simulation) {
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
     ImGuiIO& io = ImGui::GetIO(); (void)io;
 
-    this->sphSolver = sphSolver;
+    this->simulation = simulation;
 
     // Setup Dear ImGui flags
     io.ConfigFlags |= ImGuiConfigFlags_DockingEnable; // Enable Docking
@@ -48,7 +48,11 @@ void ImguiUI::endRender() {
 void ImguiUI::mainInfoBoard(uint32_t& sceneSelector, std::vector<Scene>& scenes, bool& shadowsOn) {
     ImGui::Begin("Renderer Info");
     ImGui::Text("OpenGL Version: %s", glGetString(GL_VERSION));
-    ImGui::Text("FPS: %.1f", ImGui::GetIO().Framerate);
+    ImGui::Text("Render FPS: %.1f", ImGui::GetIO().Framerate);
+    ImGui::Text("Simulation: %.1f steps/s, %.2f ms/step, step %llu", simulation->getStepsPerSecond(), simulation->getStepMs(),
+                (unsigned long long)simulation->getStepCount());
+    int maxSteps = simulation->getMaxStepsPerSecond();
+    if (ImGui::DragInt("Max Steps/s (0 unlimited)", &maxSteps, 1, 0, 10000)) simulation->setMaxStepsPerSecond(maxSteps);
     ImGui::Text("Current GPU :%s", glGetString(GL_RENDERER));
     ImGui::Text("vendor: %s", glGetString(GL_VENDOR));
     ImGui::Checkbox("Shadows On", &shadowsOn);
@@ -73,6 +77,7 @@ void ImguiUI::simpleScene(Scene& scene, Camera& camera, CameraController& camera
     ImGui::SliderFloat("Gamma", &gamma, 0.1f, 3.0f, "%.1f");
 
     if (scene.name == "SPH Demo") sphDemo(scene);
+    memoryUsage(scene);
 
     transforms(scene);
     cameraConfig(camera, cameraController);
@@ -81,22 +86,121 @@ void ImguiUI::simpleScene(Scene& scene, Camera& camera, CameraController& camera
     ImGui::End();
 }
 
+void ImguiUI::memoryUsage(Scene& scene) {
+    if (!ImGui::CollapsingHeader("Memory")) return;
+    MemoryReport report;
+    report.append("scene", scene.getMemoryReport());
+    // as of the last step the stats were read, the solver is never read from this thread
+    if (scene.name == "SPH Demo") {
+        simulation->requestStats();
+        report.append("solver", simulation->snapshot().stats.memory);
+    }
+
+    auto kib = [](size_t bytes) { return bytes / 1024.0; };
+    ImGui::Text("Total: %.1f KiB used, %.1f KiB held", kib(report.totalBytes()), kib(report.totalCapacity()));
+    ImGui::Text("Solver %.1f KiB, models %.1f KiB, GPU buffers %.1f KiB", kib(report.totalCapacity("solver")),
+                kib(report.totalCapacity("scene/models")), kib(report.totalCapacity("scene/buffers")));
+    if (!ImGui::BeginTable("Memory", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp)) return;
+    ImGui::TableSetupColumn("Component");
+    ImGui::TableSetupColumn("Used (KiB)");
+    ImGui::TableSetupColumn("Held (KiB)");
+    ImGui::TableHeadersRow();
+    for (const MemoryEntry& entry : report.entries) {
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(entry.name.c_str());
+        ImGui::TableNextColumn();
+        ImGui::Text("%.1f", kib(entry.bytes));
+        ImGui::TableNextColumn();
+        ImGui::Text("%.1f", kib(entry.capacity));
+    }
+    ImGui::EndTable();
+}
+
 void ImguiUI::sphDemo(Scene& scene) {
     if (!ImGui::CollapsingHeader("SPH Demo")) return;
+    // the stats are those of the last snapshot, read after the step following the last
+    // request. edits and buttons are handed to the simulation thread and picked up before
+    // its next step
+    simulation->requestStats();
+    const SolverStats& stats = simulation->snapshot().stats;
+    SolverSettings settings = simulation->getSettings();
+    bool changed = false;
     ImGui::Text("SPH Demo Controls");
-    ImGui::Text("Number of Particles: %zu", sphSolver->particles.size());
-    ImGui::Text("Average Density: %.2f", sphSolver->getAverageDensity());
-    ImGui::Text("Mass: %.2f", sphSolver->mass);
-    ImGui::DragFloat("Rest Density", &sphSolver->restDensity, 1.0f, 0.1f, 1000.0f);
-    ImGui::DragFloat("Gravity", &sphSolver->gravity_m, 0.001f, -1.0f, 1.0f);
-    ImGui::DragFloat("Smoothing Radius", &sphSolver->h, 0.001f, 0.01f, 5.0f);
-    ImGui::DragFloat("pressure multiplier", &sphSolver->pressure_multiplier, 0.001f, 0.01f, 1.0f);
-    ImGui::DragFloat("Viscosity", &sphSolver->viscosity, 0.001f, 0.0f, 0.1f);
-    ImGui::DragFloat("max speed", &sphSolver->max_speed, 0.1f, 0.1f, 20.0f);
-    if (ImGui::Button("Spawn Particles")) sphSolver->spawnParticles();
-    if (ImGui::Button("Spawn Random Particles")) sphSolver->spawnRandom();
-    if (ImGui::Button("Clear Particles")) sphSolver->reset();
-    if (ImGui::Button("Stop Particles")) sphSolver->stop();
+    ImGui::Text("Number of Particles: %zu", stats.liveCount);
+    ImGui::Text("Slots: %zu (%.1f%% free), %llu compactions", stats.slots, 100.0f * stats.fragmentation,
+                (unsigned long long)stats.compactionCount);
+    changed |= ImGui::DragFloat("Compaction Threshold", &settings.compactionThreshold, 0.01f, 0.0f, 1.0f);
+    ImGui::Text("Particle data: %.1f MiB, %s velocity/density/pressure", stats.particleBytes / (1024.0 * 1024.0),
+                sizeof(StoredFloat) == sizeof(float) ? "fp32" : "fp16");
+    ImGui::Text("Average Density: %.2f", stats.averageDensity);
+    ImGui::Text("Mass: %.2f", stats.mass);
+    changed |= ImGui::DragFloat("Rest Density", &settings.restDensity, 1.0f, 0.1f, 1000.0f);
+    changed |= ImGui::DragFloat("Gravity", &settings.gravity_m, 0.001f, -1.0f, 1.0f);
+    changed |= ImGui::DragFloat("Smoothing Radius", &settings.h, 0.001f, 0.01f, 5.0f);
+    changed |= ImGui::DragFloat("pressure multiplier", &settings.pressure_multiplier, 0.001f, 0.01f, 1.0f);
+    changed |= ImGui::DragFloat("Viscosity", &settings.viscosity, 0.001f, 0.0f, 0.1f);
+    changed |= ImGui::DragFloat("max speed", &settings.max_speed, 0.1f, 0.1f, 20.0f);
+    changed |= ImGui::DragInt("Reorder Interval (0 auto, -1 off)", &settings.reorderInterval, 1, -1, 1000);
+    ImGui::Text("Reorders: %llu", (unsigned long long)stats.reorderCount);
+    const char* searchNames[] = {"Dense Grid", "Compact Hash"};
+    changed |= ImGui::Combo("Neighbour Search", reinterpret_cast<int*>(&settings.neighbourSearch), searchNames, 2);
+    ImGui::Text("Search memory: %.1f KiB over %zu cells", stats.searchMemory / 1024.0, stats.cellCount);
+    ImGui::Text("Step scratch: %.1f KiB peak, %.1f KiB reserved", stats.scratchHighWater / 1024.0, stats.scratchCapacity / 1024.0);
+    changed |= ImGui::DragInt("Cells per h", &settings.cellsPerH, 1, 1, MAX_CELLS_PER_H);
+    // same step as the renderer
+    if (ImGui::Button("Calibrate Cells per h")) simulation->post(SolverCommand::Calibrate);
+    ImGui::Text("Stencil: %d cells", stats.stencilCells);
+    ImGui::Text("Changed cell: %.2f%% (%llu builds)", 100.0f * stats.gridStats.changedFraction,
+                (unsigned long long)stats.gridStats.builds);
+    changed |= ImGui::Checkbox("Symmetric Pairs", &settings.useSymmetricPairs);
+    changed |= ImGui::DragInt("Threads", &settings.numThreads, 1, 1, 64);
+    changed |= ImGui::Checkbox("Work Stealing", &settings.useWorkStealing);
+    if (settings.useWorkStealing) {
+        for (size_t t = 0; t < stats.workers.size(); ++t) {
+            const WorkerStats& worker = stats.workers[t];
+            ImGui::Text("Thread %zu: %.2f ms busy, %.2f ms idle, %llu blocks, %llu steals", t, worker.busyMs, worker.idleMs,
+                        (unsigned long long)worker.tasks, (unsigned long long)worker.steals);
+        }
+    }
+    const char* hugePageNames[] = {"Kernel Default", "Off", "Transparent", "Explicit"};
+    changed |= ImGui::Combo("Huge Pages", reinterpret_cast<int*>(&settings.hugePages), hugePageNames, 4);
+    changed |= ImGui::Checkbox("NUMA First Touch", &settings.numaFirstTouch);
+    ImGui::Text("Mapped: %.1f MiB, %llu hugetlb mappings (%llu fell back)", stats.pageStats.mappedBytes / (1024.0 * 1024.0),
+                (unsigned long long)stats.pageStats.explicitMappings, (unsigned long long)stats.pageStats.explicitFallbacks);
+    changed |= ImGui::Checkbox("Tiled Passes", &settings.useTiles);
+    if (settings.useTiles) {
+        changed |= ImGui::DragInt("Tile Cells", &settings.tileCells, 1, 1, 64);
+        ImGui::Text("Tiles: %zu, %.1f MiB gathered per step, largest %.0f KiB", stats.tileStats.tiles,
+                    stats.tileStats.gatheredBytes / (1024.0 * 1024.0), stats.tileStats.largestTileBytes / 1024.0);
+    }
+    changed |= ImGui::Checkbox("Pair Cache", &settings.usePairCache);
+    if (settings.usePairCache) {
+        int budgetMiB = static_cast<int>(settings.pairCacheBudget >> 20);
+        if (ImGui::DragInt("Pair Cache Budget (MiB)", &budgetMiB, 1, 1, 4096)) {
+            settings.pairCacheBudget = static_cast<size_t>(budgetMiB) << 20;
+            changed = true;
+        }
+        const PairCacheStats& cache = stats.pairCacheStats;
+        ImGui::Text("Pairs: %zu, %.1f MiB, %u/%zu particles cached", cache.pairs, cache.bytes / (1024.0 * 1024.0),
+                    cache.cachedParticles, stats.liveCount);
+    }
+    changed |= ImGui::Checkbox("Verlet Lists", &settings.useVerletLists);
+    if (settings.useVerletLists) {
+        const VerletStats& verlet = stats.verletStats;
+        changed |= ImGui::DragFloat("Verlet Skin", &settings.verletSkin, 0.001f, 0.0f, 0.1f);
+        ImGui::Text("Rebuilds: %llu / %llu steps", (unsigned long long)verlet.rebuilds, (unsigned long long)verlet.steps);
+        ImGui::Text("Steps since rebuild: %u (max move %.4f)", verlet.stepsSinceRebuild, verlet.maxDisplacement);
+        ImGui::Text("List entries: %zu (%zu inside h)", verlet.listEntries, verlet.pairsInRange);
+        changed |= ImGui::Checkbox("Compress Lists", &settings.compressVerletLists);
+        ImGui::Text("List memory: %.1f MiB (%zu wide lists)", verlet.listBytes / (1024.0 * 1024.0), verlet.wideLists);
+    }
+    if (changed) simulation->setSettings(settings);
+    if (ImGui::Button("Spawn Particles")) simulation->post(SolverCommand::SpawnParticles);
+    if (ImGui::Button("Spawn Random Particles")) simulation->post(SolverCommand::SpawnRandom);
+    if (ImGui::Button("Remove Random Particles")) simulation->post(SolverCommand::RemoveRandom);
+    if (ImGui::Button("Clear Particles")) simulation->post(SolverCommand::Clear);
+    if (ImGui::Button("Stop Particles")) simulation->post(SolverCommand::Stop);
 }
 
 void ImguiUI::transforms(Scene& scene) {
@@ -5,6 +5,7 @@
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 #include "sph.hpp"
+#include "simulationThread.hpp"
 
 #include "scene.hpp"
 
@@ -15,12 +16,13 @@
 class ImguiUI {
 private:
     GLFWwindow* window;
-    SPHSolver* sphSolver;
+    // runs the SPH solver, which is only read and changed through it
+    SimulationThread* simulation;
 public:
     ImguiUI() {};
     ~ImguiUI();
 
-    void init(GLFWwindow* win, const std::string& glsl_version, SPHSolver* sphSolver);
+    void init(GLFWwindow* win, const std::string& glsl_version, SimulationThread* simulation);
 
     void beginRender();
     void render() {ImGui::Render();}
@@ -31,6 +33,7 @@ public:
 
 private:
     void sphDemo(Scene& scene);
+    void memoryUsage(Scene& scene);
     void transforms(Scene& scene);
     void cameraConfig(Camera& camera, CameraController& cameraController);
     void lightConfig(std::vector<Model>& models, uint32_t LightModelIdx);
@@ -9,6 +9,7 @@
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/hash.hpp>
 
+#include <algorithm>
 #include <unordered_map>
 #include <iostream>
 #include <stdexcept>
@@ -55,12 +56,32 @@ void Model::loadTexture(const std::string& path) {
     if (data) {
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
         glGenerateMipmap(GL_TEXTURE_2D);
+        textureBytes = 0;
+        for (int w = width, h = height;; w = std::max(w / 2, 1), h = std::max(h / 2, 1)) {
+            textureBytes += static_cast<size_t>(w) * h * 3;
+            if (w == 1 && h == 1) break;
+        }
     } else {
         std::cerr << "Failed to load texture: " << path << std::endl;
     }
     stbi_image_free(data);
 }
 
+MemoryReport Model::getMemoryReport() const {
+    MemoryReport report;
+    size_t bytes = 0, capacity = 0;
+    auto vectors = [&](const auto&... v) {
+        bytes = (0 + ... + (v.size() * sizeof(v[0])));
+        capacity = (0 + ... + (v.capacity() * sizeof(v[0])));
+    };
+    vectors(vertices, verticesNoTex, pVertices, particleTs);
+    report.add("vertices", bytes, capacity);
+    vectors(indices);
+    report.add("indices", bytes, capacity);
+    if (textureBytes) report.add("texture", textureBytes, textureBytes);
+    return report;
+}
+
 void Model::simpleTriangle() {
     vertices = {
         {{0.0f, 0.5f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.5f, 1.0f}},
@@ -11,6 +11,8 @@
 
 #include "stb_image.h"
 
+#include "memoryReport.hpp"
+
 #include <vector>
 #include <string>
 
@@ -66,6 +68,8 @@ struct ParticleT {
 class Model {
 private:
     uint32_t texture;
+    // rgb8 texture with its mip chain, as uploaded by loadTexture
+    size_t textureBytes = 0;
 
 public:
 
@@ -101,6 +105,9 @@ public:
     void loadTexture(const std::string& path);
     void loadModel(const std::string& path);
 
+    // vertex and index arrays on the cpu side, and the texture on the gpu
+    MemoryReport getMemoryReport() const;
+
     std::vector<Vertex>& getVertices() {return vertices;}
     std::vector<VertexNoTex>& getVerticesNoTex() {return verticesNoTex;}
     std::vector<PVertex>& getPVertices() {return pVertices;}
@@ -9,6 +9,7 @@
 
 Renderer::Renderer() {}
 Renderer::~Renderer() {
+    simulation.stop();
     for (auto& scene : scenes) {
         for (auto& shader : scene.getShaders()) shader.cleanup();
         for (auto& buffer : scene.getBuffers()) buffer.cleanup();
@@ -21,12 +22,14 @@ Renderer::~Renderer() {
 void Renderer::init() {
     initWindow();
     initOpenGL();
-    imguiUI.init(window, std::to_string(OPENGL_VERSION_MAJOR * 100 + OPENGL_VERSION_MINOR * 10), &sphSolver);
+    imguiUI.init(window, std::to_string(OPENGL_VERSION_MAJOR * 100 + OPENGL_VERSION_MINOR * 10), &simulation);
     initScenes();
     initShadowMap();
     initRenderStuff();
     sceneSelector = 0;
     glfwSwapInterval(1);
+    simulation.setPaused(true);
+    simulation.start();
     // move the camera a tiny bit up
 }
 
@@ -39,6 +42,7 @@ void Renderer::render() {
 
     if (sceneSelector != currentSceneIdx) currentSceneIdx = sceneSelector;
     if (currentSceneIdx == scenes.size() - 1) currentSceneType = SPH_DEMO;
+    simulation.setPaused(currentSceneType != SPH_DEMO);
 
     if (isPerspective) {
         camera.updateProjectionMatrix(static_cast<float>(width), static_cast<float>(height));
@@ -74,25 +78,25 @@ void Renderer::renderSphDemoScene() {
     std::vector<Shader>& shaders = currentScene.getShaders();
     std::vector<Buffer>& buffers = currentScene.getBuffers();
     std::vector<Renderable>& renderables = currentScene.getRenderables();
-    sphSolver.update(0.001f);
+    // the solver steps on its own thread, this frame draws whatever step it published last
+    bool newSnapshot = simulation.acquireSnapshot();
     for (auto& obj : renderables) {
         Shader& shader = shaders[obj.shaderIdx];
         Buffer& buffer = buffers[obj.bufferIdx];
         Model& model = models[obj.modelIdx];
         if (model.isTextured) model.bindTexture();
         if (model.name == "cube") {
-            // update the sphSolver container
-            sphSolver.boxPos = model.getTransform().translationVec;
-            sphSolver.boxSize = model.getTransform().scaleVec;
+            // update the sphSolver container, the next step picks it up
+            simulation.setBox(model.getTransform().translationVec, model.getTransform().scaleVec);
             glCullFace(GL_FRONT);
         }
         shader.use();
 
         if (shader.getName() == "sph") {
-            sphSolver.radius = model.getRadius();
+            simulation.setRadius(model.getRadius());
             shader.setUniform("view", UniformType::MAT4, camera.getViewMatrix());
             shader.setUniform("projection", UniformType::MAT4, camera.getProjectionMatrix());
-            shader.setUniform("radius", UniformType::FLOAT, sphSolver.radius);
+            shader.setUniform("radius", UniformType::FLOAT, model.getRadius());
 
             shader.setUniform("lightPos", UniformType::VEC3, models[currentScene.LightModelIdx].getTransform().translationVec);
             shader.setUniform("lightColor", UniformType::VEC3, models[currentScene.LightModelIdx].getColor());
@@ -103,11 +107,15 @@ void Renderer::renderSphDemoScene() {
             shader.setUniform("attenuationFactor", UniformType::FLOAT, models[currentScene.LightModelIdx].light.attenuationFactor);
             shader.setUniform("showDepth", UniformType::BOOL, showDepth);
             
-            buffer.updateInstanceData(
-                sphSolver.particles.data(),
-                sizeof(Particle),
-                sphSolver.particles.size()
-            );
+            // the buffer still holds the last snapshot if there is no newer one
+            if (newSnapshot) {
+                const std::vector<Particle>& instances = simulation.snapshot().particles;
+                buffer.updateInstanceData(
+                    instances.data(),
+                    sizeof(Particle),
+                    instances.size()
+                );
+            }
 
             buffer.bindInstanced();
             buffer.drawInstanced();
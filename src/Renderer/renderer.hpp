@@ -8,6 +8,7 @@
 #include "buffer.hpp"
 #include "imguiUI.hpp"
 #include "scene.hpp"
+#include "simulationThread.hpp"
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -67,6 +68,8 @@ private:
     bool shadowsOn = false;
 
     SPHSolver sphSolver;
+    // steps sphSolver while the SPH demo is shown, declared after it so it stops first
+    SimulationThread simulation{sphSolver};
 
 public:
 
@@ -52,6 +52,18 @@ void Scene::clearSceneData() {
     renderableMap.clear();
 }
 
+MemoryReport Scene::getMemoryReport() const {
+    MemoryReport report;
+    for (const Model& model : models) report.append("models/" + model.name, model.getMemoryReport());
+    std::vector<std::string> bufferNames(buffers.size());
+    for (const auto& [bufferName, idx] : bufferMap) bufferNames[idx] = bufferName;
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        std::string bufferName = bufferNames[i].empty() ? std::to_string(i) : bufferNames[i];
+        report.append("buffers/" + bufferName, buffers[i].getMemoryReport());
+    }
+    return report;
+}
+
 void Scene::initSphShaders() {
     initSimpleShader();
     initLightShader();
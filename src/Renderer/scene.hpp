@@ -42,6 +42,9 @@ public:
     void clearSceneData();
     void refreshBuffers(uint32_t modelIdx);
 
+    // every model and buffer of the scene, as "models/<name>/..." and "buffers/<name>/..."
+    MemoryReport getMemoryReport() const;
+
     void emptyScene();
     void initExampleScene1();
     void floorScene();